@@ -0,0 +1,38 @@
+# shst_add_preload_library(<target> [LIBRARY <file or target>...] [SYMBOLS <symbol>...] [EXCLUDE <symbol>...]
+#                          [STACK_BYTES <n>])
+#
+# Adds shared library <target> for LD_PRELOAD, guarding calls of the functions named in SYMBOLS and of all the
+# functions each LIBRARY exports, but those in EXCLUDE. Its source is written by shst-preload-gen at build time, again
+# whenever a LIBRARY changes. STACK_BYTES is how many bytes of stack arguments get passed on (64 by default).
+
+set(SHST_PRELOAD_INCLUDE_DIR "${CMAKE_CURRENT_LIST_DIR}/../src")
+
+function(shst_add_preload_library target)
+    cmake_parse_arguments(PRELOAD "" "STACK_BYTES" "LIBRARY;SYMBOLS;EXCLUDE" ${ARGN})
+    set(source "${CMAKE_CURRENT_BINARY_DIR}/${target}.c")
+    set(arguments --output=${source})
+    set(depends shst-preload-gen)
+    foreach (library IN LISTS PRELOAD_LIBRARY)
+        if (TARGET ${library})
+            list(APPEND arguments --library=$<TARGET_FILE:${library}>)
+        else ()
+            list(APPEND arguments --library=${library})
+        endif ()
+        list(APPEND depends ${library})
+    endforeach ()
+    foreach (symbol IN LISTS PRELOAD_EXCLUDE)
+        list(APPEND arguments --exclude=${symbol})
+    endforeach ()
+    if (PRELOAD_STACK_BYTES)
+        list(APPEND arguments --stack-bytes=${PRELOAD_STACK_BYTES})
+    endif ()
+
+    add_custom_command(OUTPUT ${source}
+                       COMMAND shst-preload-gen ${arguments} ${PRELOAD_SYMBOLS}
+                       DEPENDS ${depends}
+                       COMMENT "Generating preload library ${target}"
+                       VERBATIM)
+    add_library(${target} SHARED ${source})
+    target_include_directories(${target} PRIVATE ${SHST_PRELOAD_INCLUDE_DIR})
+    target_link_libraries(${target} shst ${CMAKE_DL_LIBS})
+endfunction()
@@ -1,6 +1,5 @@
 #include "../src/shadow-stack.hpp"
 #include "../src/shadow-stack-common.h"
-#include <map>
 #include <dlfcn.h>
 #include <stdio.h>
 
@@ -32,21 +31,14 @@ struct RealCallLogger
 
 shst_f load_next(const char* name)
 {
-    static std::map<const char*, shst_f> symbols;
-    auto symbol = symbols.find(name);
-    if (symbol == symbols.end()) {
-        auto real = reinterpret_cast<shst_f>(dlsym(RTLD_NEXT, name));
-        symbols.emplace(name, real);
-        return real;
-    }
-    return symbol->second;
+    return reinterpret_cast<shst_f>(dlsym(RTLD_NEXT, name));
 }
 
 #define WRAP(real_function_name)                                                            \
     extern "C" void* real_function_name(                                                    \
             void* x0, void* x1, void* x2, void* x3, void* x4, void* x5, void* x6, void* x7) \
     {                                                                                       \
-        auto real = load_next(#real_function_name);                                         \
+        static auto const real = load_next(#real_function_name); /* looked up once */       \
         RealCallLogger logger(#real_function_name, real);                                   \
         return shst::invoke(real, x0, x1, x2, x3, x4, x5, x6, x7);                          \
     }
@@ -0,0 +1,103 @@
+#include "shadow-stack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Calls of a shared library guarded by shst_attach_library() while the process runs: nothing guarded before, every
+// call of a matching function while attached, nothing again once detached. Then the cost of a call in each state.
+
+typedef struct
+{
+    double x, y;
+} Vec;
+
+long weighted(long a, long b, long c, long d, long e, long f, long g, long h);
+Vec scale(Vec v, double s);
+double average(int n, ...);
+void overrun(int volatile* victim);
+
+#define LIBRARY "libpreload-test-lib.so"
+
+int failures = 0;
+
+void expect(int ok, char const* what)
+{
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+shst_stats stats(void)
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats;
+}
+
+// calls of all of them, how many came out right
+int call_all(void)
+{
+    Vec const v = scale((Vec){1.5, -2.0}, 2.0);
+    return (weighted(1, 2, 3, 4, 5, 6, 7, 8) == 204) + (v.x == 3.0 && v.y == -4.0) +
+           (average(4, 1.0, 2.0, 3.0, 6.0) == 3.0);
+}
+
+double now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+double ns_per_call(void)
+{
+    int const iterations = 1 << 18;
+    double const start = now_ns();
+    long volatile sink = 0;
+    for (int i = 0; i < iterations; ++i) {
+        sink += weighted(i, 2, 3, 4, 5, 6, 7, 8);
+    }
+    return (now_ns() - start) / iterations;
+}
+
+int outer(void)
+{
+    int volatile local[4] = {0};
+
+    expect(call_all() == 3 && stats().calls == 0, "not attached, not guarded");
+    double const detached_ns = ns_per_call();
+
+    expect(shst_attach_library(LIBRARY, NULL, SHST_TRAMPOLINE_STACK_BYTES, SHST_ATTACH_PLT) == 4,
+           "attached, 4 functions called");
+    expect(call_all() == 3 && stats().calls == 3 && stats().failed_checks == 0, "guarded, no corruption");
+    overrun(&local[2]);
+    expect(stats().calls == 4 && stats().failed_checks == 1, "corruption found");
+    local[2] -= 1;
+    expect(shst_attach_library(LIBRARY, NULL, SHST_TRAMPOLINE_STACK_BYTES, SHST_ATTACH_PLT) == 0,
+           "attached twice, nothing more");
+    double const attached_ns = ns_per_call();
+
+    expect(shst_detach_library(LIBRARY) == 4, "detached, 4 entries put back");
+    unsigned long long const calls = stats().calls;
+    expect(call_all() == 3 && stats().calls == calls, "detached, not guarded");
+
+    expect(shst_attach_library(LIBRARY, "[ws]*", SHST_TRAMPOLINE_STACK_BYTES, SHST_ATTACH_PLT) == 2,
+           "attached by pattern, 2 functions");
+    expect(call_all() == 3 && stats().calls == calls + 2, "only those guarded");
+    expect(shst_detach_library(LIBRARY) == 2, "detached again");
+
+    expect(shst_attach_library("libnot-loaded.so", NULL, SHST_TRAMPOLINE_STACK_BYTES, SHST_ATTACH_PLT) == -1,
+           "library not loaded");
+
+    printf("ns per call: detached %.1f, attached %.1f\n", detached_ns, attached_ns);
+    return local[0];
+}
+
+int main(void)
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    outer();
+
+    return failures ? 1 : 0;
+}
@@ -1,6 +1,8 @@
 #include "callee_traits.hpp"
+#include "shadow-stack.h"
 #include "shadow-stack.hpp"
 #include <cstdio>
+#include <cstdlib>
 #include <functional>
 
 #include <array>
@@ -149,6 +151,105 @@ void test()
 
 } // namespace shst
 
+// Check modes and limits: outer() -> middle() -> inner(), inner() writes to the frame of outer() and the post-return
+// check of its call, made with SHST_REACTION=heal, has to find it or not. The frame record of outer() lies in the
+// frame of the call of middle(), one deeper than the frame of the call of inner().
+namespace checks {
+
+enum class Write
+{
+    nothing,
+    local,
+    return_address,
+};
+
+struct Outcome
+{
+    bool reported;
+    bool intact;
+};
+
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+unsigned long long failed_checks()
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats.failed_checks;
+}
+
+__attribute__((noinline)) int inner(Write what, void* volatile* record, unsigned volatile* local)
+{
+    if (what == Write::local) {
+        local[32] = 1;
+    } else if (what == Write::return_address) {
+        record[1] = static_cast<char*>(record[1]) + 1;
+    }
+    return 0;
+}
+
+__attribute__((noinline)) Outcome middle(Write what, void* volatile* record, unsigned volatile* local)
+{
+    auto const before = failed_checks();
+    auto const return_address = record[1];
+    shst::invoke(inner, what, record, local);
+    Outcome const outcome{failed_checks() != before, record[1] == return_address && local[32] == 0};
+    // whatever was not healed, outer() still has to return
+    record[1] = return_address;
+    local[32] = 0;
+    return outcome;
+}
+
+__attribute__((noinline)) Outcome outer(Write what)
+{
+    unsigned volatile local[64]{};
+    return shst::invoke(middle, what, static_cast<void* volatile*>(__builtin_frame_address(0)), local);
+}
+
+void run()
+{
+    setenv("SHST_REACTION", "heal", 1);
+    shst_reload_config();
+
+    // healing needs the copy, SHST_FINGERPRINT_COPY=auto keeps it for SHST_REACTION=heal
+    shst_set_check_mode(SHST_CHECK_FINGERPRINT);
+    auto outcome = outer(Write::local);
+    expect(outcome.reported, "fingerprint: corrupted frame is reported");
+    expect(outcome.intact, "fingerprint: corrupted frame is healed from the copy");
+    outcome = outer(Write::nothing);
+    expect(!outcome.reported && outcome.intact, "fingerprint: unmodified frame passes");
+
+    shst_set_check_mode(SHST_CHECK_RETURN_ADDRESS);
+    outcome = outer(Write::return_address);
+    expect(outcome.reported, "return address: smashed return address is reported");
+    expect(outcome.intact, "return address: smashed return address is healed");
+    outcome = outer(Write::local);
+    expect(!outcome.reported, "return address: write to a local is ignored");
+
+    shst_set_check_mode(SHST_CHECK_EXACT);
+    shst_set_check_depth(1);
+    expect(!outer(Write::return_address).reported, "depth 1: corruption one frame deeper is not reported");
+    shst_set_check_depth(2);
+    expect(outer(Write::return_address).reported, "depth 2: corruption one frame deeper is reported");
+    shst_set_check_depth(SHST_CHECK_FULL);
+    shst_set_check_bytes(sizeof(void*));
+    expect(!outer(Write::return_address).reported, "bytes 8: corruption one frame deeper is not reported");
+    shst_set_check_bytes(64 * 1024);
+    expect(outer(Write::return_address).reported, "bytes 64 KiB: corruption one frame deeper is reported");
+    shst_set_check_bytes(SHST_CHECK_FULL);
+
+    unsetenv("SHST_REACTION");
+    shst_reload_config();
+}
+
+} // namespace checks
+
 int foo_wrapper(void* a, void* b, void* c, void* d)
 {
     return shst::invoke(foo, a, b, c, d);
@@ -161,6 +262,12 @@ int bar_wrapper(int a, int b, int c, int d)
 
 int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[])
 {
+    checks::run();
+    if (checks::failures) {
+        return 1;
+    }
+    fflush(stdout);
+    // the corruption made by f13() aborts from here on
     bar_wrapper(1, 2, 3, 4);
     foo_wrapper(nullptr, nullptr, nullptr, nullptr);
     shst::test();
@@ -0,0 +1,64 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <alloca.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Cost of a guarded call in each check mode for growing frame sizes. Checks are limited to the newest frame so
+// that only the per-frame cost is measured, not the depth of the stack.
+
+constexpr int depth = 16;
+
+volatile int sink;
+
+int nested(int level, size_t frame)
+{
+    auto local = static_cast<uint8_t volatile*>(alloca(frame));
+    local[0] = level;
+    local[frame - 1] = level;
+    if (level == 0) {
+        return local[0];
+    }
+    return shst::invoke(nested, level - 1, frame) + local[frame - 1];
+}
+
+double ns_per_call(size_t frame)
+{
+    auto const iterations = std::max<size_t>(16, (size_t{64} << 20) / (frame * depth));
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink = shst::invoke(nested, depth, frame);
+    }
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (iterations * (depth + 1));
+}
+
+int main()
+{
+    struct
+    {
+        shst_check_mode mode;
+        char const* name;
+    } const modes[]{
+            {SHST_CHECK_EXACT, "exact"},
+            {SHST_CHECK_FINGERPRINT, "fingerprint"},
+            {SHST_CHECK_RETURN_ADDRESS, "return-address"},
+    };
+
+    shst_set_check_depth(1);
+    printf("%10s", "frame");
+    for (auto const& mode : modes) {
+        printf(" %15s", mode.name);
+    }
+    printf("   [ns per guarded call]\n");
+
+    for (size_t frame = 64; frame <= 64 * 1024; frame *= 4) {
+        printf("%10zu", frame);
+        for (auto const& mode : modes) {
+            shst_set_check_mode(mode.mode);
+            printf(" %15.1f", ns_per_call(frame));
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,62 @@
+#include "compare.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// shst::compare() and the kernels behind it vs. glibc memcmp(), on areas of various sizes. compare() lets memcmp()
+// tell equal areas apart (the common case of every check) and runs the kernel only over differing ones, which makes
+// those two passes: the second table shows what that costs over the kernel alone.
+
+volatile int sink;
+
+template <typename F>
+double ns_per_call(size_t size, F&& f)
+{
+    auto const iterations = std::max<size_t>(64, (size_t{256} << 20) / size);
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink = f();
+    }
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+void print_table(std::vector<uint8_t> const& actual, std::vector<uint8_t> const& shadow, char const* what)
+{
+    auto const kernels = shst::compare_kernels();
+    shst::DiffRanges ranges;
+
+    printf("%10s %12s %12s", "size", "memcmp", "compare");
+    for (auto const& kernel : kernels) {
+        printf(" %12s", kernel.name);
+    }
+    printf("   [ns per call, %s]\n", what);
+
+    for (size_t size = 64; size <= actual.size(); size *= 4) {
+        // the areas end where they differ, if they do
+        auto const a = actual.data() + actual.size() - size;
+        auto const s = shadow.data() + shadow.size() - size;
+        printf("%10zu %12.1f", size, ns_per_call(size, [&] { return memcmp(a, s, size); }));
+        printf(" %12.1f", ns_per_call(size, [&] {
+                   ranges.clear();
+                   return shst::compare(a, s, size, ranges);
+               }));
+        for (auto const& kernel : kernels) {
+            printf(" %12.1f", ns_per_call(size, [&] {
+                       ranges.clear();
+                       return kernel.compare(a, s, size, ranges, 0, 4096);
+                   }));
+        }
+        printf("\n");
+    }
+}
+
+int main()
+{
+    size_t const max_size = 1 << 20;
+    std::vector<uint8_t> actual(max_size, 0x5a), shadow(max_size, 0x5a);
+    print_table(actual, shadow, "equal areas");
+    actual.back() ^= 1;
+    print_table(actual, shadow, "last byte differs");
+}
@@ -0,0 +1,94 @@
+#include "compare.hpp"
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Every compare kernel available on this CPU must find exactly the same runs of differing bytes as a naive
+// byte by byte scan, regardless of size, alignment and where the differences are.
+
+shst::DiffRanges reference(uint8_t const* a, uint8_t const* b, size_t size, size_t base)
+{
+    shst::DiffRanges ranges;
+    for (size_t i = 0; i < size; ++i) {
+        if (a[i] == b[i]) {
+            continue;
+        }
+        if (!ranges.empty() && ranges.back().offset + ranges.back().length == base + i) {
+            ranges.back().length++;
+        } else {
+            ranges.push_back({base + i, 1});
+        }
+    }
+    return ranges;
+}
+
+bool same(shst::DiffRanges const& a, shst::DiffRanges const& b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].offset != b[i].offset || a[i].length != b[i].length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    std::mt19937 random{42};
+    std::vector<uint8_t> actual(4096 + 64), shadow(4096 + 64);
+    int failures = 0;
+
+    for (auto const& kernel : shst::compare_kernels()) {
+        int cases = 0;
+        for (size_t size : {0, 1, 7, 63, 64, 65, 127, 128, 200, 1000, 4096}) {
+            for (size_t misalign : {0, 1, 13}) {
+                for (int diffs : {0, 1, 2, 5, 50, 1000}) {
+                    for (size_t i = 0; i < actual.size(); ++i) {
+                        actual[i] = shadow[i] = random();
+                    }
+                    auto a = actual.data() + misalign;
+                    auto s = shadow.data() + misalign;
+                    for (int d = 0; size && d < diffs; ++d) {
+                        auto const at = random() % size;
+                        auto const run = std::min<size_t>(1 + random() % 70, size - at);
+                        for (size_t k = 0; k < run; ++k) {
+                            a[at + k] = ~s[at + k];
+                        }
+                    }
+
+                    auto const expected = reference(a, s, size, 100);
+                    shst::DiffRanges found;
+                    auto const equal = kernel.compare(a, s, size, found, 100, 4096);
+                    if (equal != expected.empty() || !same(found, expected)) {
+                        fprintf(stderr, "%s: mismatch for size %zu, misalign %zu, diffs %d\n", kernel.name, size,
+                                misalign, diffs);
+                        ++failures;
+                    }
+                    ++cases;
+                }
+            }
+        }
+
+        // range limit: the last range soaks up everything past the limit
+        for (size_t i = 0; i < 256; ++i) {
+            actual[i] = i % 2;
+            shadow[i] = 0;
+        }
+        shst::DiffRanges limited;
+        kernel.compare(actual.data(), shadow.data(), 256, limited, 0, 4);
+        if (limited.size() != 4 || limited.back().offset != 7 || limited.back().length != 256 - 7) {
+            fprintf(stderr, "%s: range limit not respected\n", kernel.name);
+            ++failures;
+        }
+        // with the limit reached before, a difference adds no range but still counts
+        if (kernel.compare(actual.data(), shadow.data(), 256, limited, 256, 4)) {
+            fprintf(stderr, "%s: difference past the range limit taken for equal\n", kernel.name);
+            ++failures;
+        }
+        printf("%-8s %d cases checked\n", kernel.name, cases + 2);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,310 @@
+#include "compare.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace shst {
+
+namespace {
+
+void emit(DiffRanges& ranges, size_t max_ranges, size_t offset, size_t length)
+{
+    if (ranges.size() < max_ranges || ranges.empty()) {
+        ranges.push_back({offset, length});
+    } else {
+        auto& last = ranges.back();
+        last.length = offset + length - last.offset;
+    }
+}
+
+// Every kernel skips equal areas 256 bytes at a time, then looks at 64 bytes at a time: first a quick equality
+// test, only when it fails a mask of differing bytes (bit n set when byte n differs) is built and walked for run
+// boundaries. Always inlined, so that vector code gets generated for the target of the calling kernel.
+template <typename Block>
+__attribute__((always_inline)) inline bool compare_blocks(uint8_t const* actual,
+                    uint8_t const* shadow,
+                    size_t size,
+                    DiffRanges& ranges,
+                    size_t offset_base,
+                    size_t max_ranges)
+{
+    // not the number of ranges, at max_ranges a difference only extends the last one
+    bool differs = false;
+    bool in_diff = false;
+    size_t start = 0;
+
+    auto walk = [&](uint64_t diff, size_t base, size_t bits) {
+        auto const valid = bits == 64 ? ~uint64_t{0} : (uint64_t{1} << bits) - 1;
+        diff &= valid;
+        auto look = in_diff ? ~diff & valid : diff;
+        while (look) {
+            auto const bit = static_cast<size_t>(__builtin_ctzll(look));
+            auto const above = bit == 63 ? 0 : ~uint64_t{0} << (bit + 1);
+            if (in_diff) {
+                emit(ranges, max_ranges, offset_base + start, base + bit - start);
+                look = diff & above;
+            } else {
+                start = base + bit;
+                differs = true;
+                look = ~diff & valid & above;
+            }
+            in_diff = !in_diff;
+        }
+    };
+
+    size_t i = 0;
+    while (i + 64 <= size) {
+        if (!in_diff) {
+            while (i + 256 <= size && Block::equal256(actual + i, shadow + i)) {
+                i += 256;
+            }
+            if (i + 64 > size) {
+                break;
+            }
+        }
+        if (in_diff ? Block::different64(actual + i, shadow + i) : Block::equal64(actual + i, shadow + i)) {
+            i += 64;
+            continue;
+        }
+        walk(Block::diff_mask64(actual + i, shadow + i), i, 64);
+        i += 64;
+    }
+    if (i < size) {
+        uint64_t diff = 0;
+        for (size_t bit = 0; i + bit < size; ++bit) {
+            diff |= uint64_t{actual[i + bit] != shadow[i + bit]} << bit;
+        }
+        walk(diff, i, size - i);
+    }
+    if (in_diff) {
+        emit(ranges, max_ranges, offset_base + start, size - start);
+    }
+    return !differs;
+}
+
+struct ScalarBlock
+{
+    static uint64_t load(uint8_t const* p)
+    {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static bool equal64(uint8_t const* a, uint8_t const* b)
+    {
+        uint64_t x = 0;
+        for (int w = 0; w < 64; w += 8) {
+            x |= load(a + w) ^ load(b + w);
+        }
+        return x == 0;
+    }
+
+    static bool equal256(uint8_t const* a, uint8_t const* b)
+    {
+        uint64_t x = 0;
+        for (int w = 0; w < 256; w += 8) {
+            x |= load(a + w) ^ load(b + w);
+        }
+        return x == 0;
+    }
+
+    static bool different64(uint8_t const* a, uint8_t const* b)
+    {
+        return diff_mask64(a, b) == ~uint64_t{0};
+    }
+
+    static uint64_t diff_mask64(uint8_t const* a, uint8_t const* b)
+    {
+        uint64_t mask = 0;
+        for (int n = 0; n < 64; ++n) {
+            mask |= uint64_t{a[n] != b[n]} << n;
+        }
+        return mask;
+    }
+};
+
+#if defined(__x86_64__)
+struct Sse2Block
+{
+    static __m128i xor16(uint8_t const* a, uint8_t const* b)
+    {
+        return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const*>(a)),
+                             _mm_loadu_si128(reinterpret_cast<__m128i const*>(b)));
+    }
+
+    static uint64_t equal_mask16(uint8_t const* a, uint8_t const* b)
+    {
+        auto const eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(a)),
+                                       _mm_loadu_si128(reinterpret_cast<__m128i const*>(b)));
+        return static_cast<uint32_t>(_mm_movemask_epi8(eq));
+    }
+
+    static __m128i xor64(uint8_t const* a, uint8_t const* b)
+    {
+        return _mm_or_si128(_mm_or_si128(xor16(a, b), xor16(a + 16, b + 16)),
+                            _mm_or_si128(xor16(a + 32, b + 32), xor16(a + 48, b + 48)));
+    }
+
+    static bool is_zero(__m128i x)
+    {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) == 0xffff;
+    }
+
+    static bool equal64(uint8_t const* a, uint8_t const* b)
+    {
+        return is_zero(xor64(a, b));
+    }
+
+    static bool equal256(uint8_t const* a, uint8_t const* b)
+    {
+        return is_zero(_mm_or_si128(_mm_or_si128(xor64(a, b), xor64(a + 64, b + 64)),
+                                    _mm_or_si128(xor64(a + 128, b + 128), xor64(a + 192, b + 192))));
+    }
+
+    static bool different64(uint8_t const* a, uint8_t const* b)
+    {
+        return diff_mask64(a, b) == ~uint64_t{0};
+    }
+
+    static uint64_t diff_mask64(uint8_t const* a, uint8_t const* b)
+    {
+        auto const equal = equal_mask16(a, b) | equal_mask16(a + 16, b + 16) << 16 |
+                           equal_mask16(a + 32, b + 32) << 32 | equal_mask16(a + 48, b + 48) << 48;
+        return ~equal;
+    }
+};
+
+struct Avx2Block
+{
+    __attribute__((target("avx2"))) static __m256i load(uint8_t const* p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+    }
+
+    __attribute__((target("avx2"))) static __m256i xor64(uint8_t const* a, uint8_t const* b)
+    {
+        return _mm256_or_si256(_mm256_xor_si256(load(a), load(b)), _mm256_xor_si256(load(a + 32), load(b + 32)));
+    }
+
+    __attribute__((target("avx2"))) static bool equal64(uint8_t const* a, uint8_t const* b)
+    {
+        auto x = xor64(a, b);
+        return _mm256_testz_si256(x, x);
+    }
+
+    __attribute__((target("avx2"))) static bool equal256(uint8_t const* a, uint8_t const* b)
+    {
+        auto x = _mm256_or_si256(_mm256_or_si256(xor64(a, b), xor64(a + 64, b + 64)),
+                                 _mm256_or_si256(xor64(a + 128, b + 128), xor64(a + 192, b + 192)));
+        return _mm256_testz_si256(x, x);
+    }
+
+    __attribute__((target("avx2"))) static bool different64(uint8_t const* a, uint8_t const* b)
+    {
+        return diff_mask64(a, b) == ~uint64_t{0};
+    }
+
+    __attribute__((target("avx2"))) static uint64_t diff_mask64(uint8_t const* a, uint8_t const* b)
+    {
+        uint64_t const lo = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(load(a), load(b))));
+        uint64_t const hi = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(load(a + 32), load(b + 32))));
+        return ~(lo | hi << 32);
+    }
+};
+
+struct Avx512Block
+{
+    __attribute__((target("avx512f,avx512bw"))) static uint64_t diff_mask64(uint8_t const* a, uint8_t const* b)
+    {
+        return _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a), _mm512_loadu_si512(b));
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) static __m512i xor64(uint8_t const* a, uint8_t const* b)
+    {
+        return _mm512_xor_si512(_mm512_loadu_si512(a), _mm512_loadu_si512(b));
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) static bool equal64(uint8_t const* a, uint8_t const* b)
+    {
+        return diff_mask64(a, b) == 0;
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) static bool equal256(uint8_t const* a, uint8_t const* b)
+    {
+        auto x = _mm512_or_si512(_mm512_or_si512(xor64(a, b), xor64(a + 64, b + 64)),
+                                 _mm512_or_si512(xor64(a + 128, b + 128), xor64(a + 192, b + 192)));
+        return _mm512_test_epi64_mask(x, x) == 0;
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) static bool different64(uint8_t const* a, uint8_t const* b)
+    {
+        return diff_mask64(a, b) == ~uint64_t{0};
+    }
+};
+
+__attribute__((target("avx2"))) bool compare_avx2(uint8_t const* actual,
+                                                  uint8_t const* shadow,
+                                                  size_t size,
+                                                  DiffRanges& ranges,
+                                                  size_t offset_base,
+                                                  size_t max_ranges)
+{
+    return compare_blocks<Avx2Block>(actual, shadow, size, ranges, offset_base, max_ranges);
+}
+
+__attribute__((target("avx512f,avx512bw"))) bool compare_avx512(uint8_t const* actual,
+                                                                uint8_t const* shadow,
+                                                                size_t size,
+                                                                DiffRanges& ranges,
+                                                                size_t offset_base,
+                                                                size_t max_ranges)
+{
+    return compare_blocks<Avx512Block>(actual, shadow, size, ranges, offset_base, max_ranges);
+}
+#endif
+
+compare_f select_compare()
+{
+    return compare_kernels().back().compare;
+}
+
+} // namespace
+
+std::vector<CompareKernel> compare_kernels()
+{
+    std::vector<CompareKernel> kernels{{"scalar", compare_blocks<ScalarBlock>}};
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    kernels.push_back({"sse2", compare_blocks<Sse2Block>});
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", compare_avx2});
+    }
+    if (__builtin_cpu_supports("avx512bw")) {
+        kernels.push_back({"avx512", compare_avx512});
+    }
+#endif
+    return kernels;
+}
+
+bool compare(uint8_t const* actual,
+             uint8_t const* shadow,
+             size_t size,
+             DiffRanges& ranges,
+             size_t offset_base,
+             size_t max_ranges)
+{
+    // nearly every check finds nothing, memcmp() is as fast as it gets at telling that and the kernel is left to
+    // locate the differences
+    if (memcmp(actual, shadow, size) == 0) {
+        return true;
+    }
+    // function-local so that guarded calls made from static initializers of other objects work too
+    static compare_f const compare_impl = select_compare();
+    return compare_impl(actual, shadow, size, ranges, offset_base, max_ranges);
+}
+
+} // namespace shst
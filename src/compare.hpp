@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace shst {
+
+// Differing bytes, offset is relative to the beginning of the compared areas
+struct DiffRange
+{
+    size_t offset;
+    size_t length;
+};
+
+using DiffRanges = std::vector<DiffRange>;
+
+// Compares two areas and appends every run of differing bytes to `ranges` (ascending, offsets relative to
+// `offset_base`). Once `max_ranges` is reached the last range is extended over further differences, so it may include
+// some equal bytes. Returns true if both areas are equal.
+//
+// Equal areas are told apart by memcmp(), which beats the kernels at that, differing ones take a second pass of an
+// SSE2, AVX2 or AVX-512 kernel picked once per process according to what the CPU supports (see compare-bench).
+bool compare(uint8_t const* actual,
+             uint8_t const* shadow,
+             size_t size,
+             DiffRanges& ranges,
+             size_t offset_base = 0,
+             size_t max_ranges = 4096);
+
+using compare_f = bool (*)(uint8_t const*, uint8_t const*, size_t, DiffRanges&, size_t, size_t);
+
+struct CompareKernel
+{
+    char const* name;
+    compare_f compare;
+};
+
+// all kernels usable on this CPU, best one last
+std::vector<CompareKernel> compare_kernels();
+
+} // namespace shst
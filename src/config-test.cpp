@@ -0,0 +1,88 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+// Configuration is parsed once at load time: environment changes take effect only with shst_reload_config(), or
+// with SHST_RELOAD_SIGNAL (the test re-executes itself to have it set at load time). The kill switch stops guards
+// from pushing anything at all.
+
+int leaf(int x)
+{
+    return x + 1;
+}
+
+unsigned long long calls()
+{
+    shst::invoke(leaf, 0);
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats.calls;
+}
+
+bool counted()
+{
+    auto const before = calls();
+    return calls() != before;
+}
+
+unsigned long long check_depth()
+{
+    shst::invoke(leaf, 0);
+    shst_governor_state state;
+    shst_get_governor_state(&state);
+    return state.check_depth;
+}
+
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+int main(int, char** argv)
+{
+    if (getenv("SHST_RELOAD_SIGNAL") == nullptr) {
+        setenv("SHST_RELOAD_SIGNAL", "USR1", 1);
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        return 1;
+    }
+
+    setenv("SHST_CHECK_DEPTH", "3", 1);
+    expect(check_depth() == 0, "environment change alone is not seen");
+    shst_reload_config();
+    expect(check_depth() == 3, "reload applies it");
+
+    shst_set_enabled(0);
+    expect(!counted(), "disabled guards push nothing");
+    shst_set_enabled(1);
+    expect(counted(), "enabled again");
+
+    char path[] = "/tmp/shst-config-XXXXXX";
+    auto const fd = mkstemp(path);
+    char const content[] = "# written by config-test\nSHST_ENABLED = no\n";
+    auto const written = write(fd, content, strlen(content));
+    close(fd);
+    setenv("SHST_CONFIG_FILE", path, 1);
+    raise(SIGUSR1);
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (counted() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    expect(written > 0 && !counted(), "signal reloads, config file overrides");
+    unlink(path);
+
+    unsetenv("SHST_CONFIG_FILE");
+    shst_reload_config();
+    expect(counted() && check_depth() == 3, "back to environment");
+
+    return failures ? 1 : 0;
+}
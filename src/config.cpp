@@ -0,0 +1,329 @@
+#include "config.hpp"
+#include "governor.hpp"
+#include "shadow-stack.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <pthread.h>
+#include <semaphore.h>
+#include <string>
+#include <strings.h>
+#include <utility>
+#include <vector>
+
+namespace shst {
+
+namespace detail {
+
+std::atomic<Config const*> current_config{};
+std::atomic<bool> enabled{true};
+
+} // namespace detail
+
+namespace {
+
+// NAME=value lines of SHST_CONFIG_FILE, they take precedence over the environment
+class Settings
+{
+  public:
+    Settings()
+    {
+        auto const path = getenv("SHST_CONFIG_FILE");
+        if (path == nullptr) {
+            return;
+        }
+        auto file = fopen(path, "r");
+        if (file == nullptr) {
+            fprintf(stderr, "shadow stack: can't read %s (%s), using environment only\n", path, strerror(errno));
+            return;
+        }
+        char* line = nullptr;
+        size_t capacity = 0;
+        while (getline(&line, &capacity, file) >= 0) {
+            parse(line);
+        }
+        free(line);
+        fclose(file);
+    }
+
+    [[nodiscard]] char const* get(char const* name) const
+    {
+        // the last assignment wins
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            if (it->first == name) {
+                return it->second.c_str();
+            }
+        }
+        return getenv(name);
+    }
+
+  private:
+    void parse(std::string line)
+    {
+        auto const comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.resize(comment);
+        }
+        auto const equals = line.find('=');
+        if (equals == std::string::npos) {
+            return;
+        }
+        auto name = trim(line.substr(0, equals));
+        if (!name.empty()) {
+            entries.emplace_back(std::move(name), trim(line.substr(equals + 1)));
+        }
+    }
+
+    static std::string trim(std::string const& s)
+    {
+        auto const begin = s.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos) {
+            return {};
+        }
+        return s.substr(begin, s.find_last_not_of(" \t\r\n") - begin + 1);
+    }
+
+    std::vector<std::pair<std::string, std::string>> entries;
+};
+
+bool is_yes(char const* value)
+{
+    return value && (strcasecmp(value, "yes") == 0 || strcasecmp(value, "true") == 0 || strcasecmp(value, "1") == 0);
+}
+
+bool is_no(char const* value)
+{
+    return value && (strcasecmp(value, "no") == 0 || strcasecmp(value, "false") == 0 || strcasecmp(value, "0") == 0);
+}
+
+Reaction parse_reaction(char const* reaction)
+{
+    if (reaction == nullptr || strcmp(reaction, "abort") == 0) {
+        return Reaction::report_and_abort;
+    } else if (strcmp(reaction, "ignore") == 0) {
+        return Reaction::ignore;
+    } else if (strcmp(reaction, "report") == 0) {
+        return Reaction::report_and_continue;
+    } else if (strcmp(reaction, "heal") == 0) {
+        return Reaction::report_heal_and_continue;
+    } else if (strcmp(reaction, "quiet-heal") == 0) {
+        return Reaction::heal_and_continue;
+    } else {
+        // default
+        return Reaction::report_and_abort;
+    }
+}
+
+// "full" or unset means no limit
+size_t parse_limit(char const* limit)
+{
+    if (limit == nullptr || strcmp(limit, "full") == 0) {
+        return 0;
+    }
+    return strtoull(limit, nullptr, 0);
+}
+
+CheckMode parse_check_mode(char const* mode)
+{
+    if (mode == nullptr || strcmp(mode, "exact") == 0) {
+        return CheckMode::exact;
+    } else if (strcmp(mode, "fingerprint") == 0) {
+        return CheckMode::fingerprint;
+    } else if (strcmp(mode, "watch") == 0) {
+        return CheckMode::watch;
+    } else if (strcmp(mode, "return-address") == 0) {
+        return CheckMode::return_address;
+    } else {
+        return CheckMode::exact;
+    }
+}
+
+int parse_dump_width(char const* width)
+{
+    auto const value = width ? std::atoi(width) : 0;
+    return value ? value : 16;
+}
+
+DumpArea parse_dump_area(char const* area)
+{
+    if (area == nullptr || strcmp(area, "both") == 0) {
+        return DumpArea::both;
+    } else if (strcmp(area, "actual") == 0) {
+        return DumpArea::actual;
+    } else if (strcmp(area, "shadow") == 0) {
+        return DumpArea::shadow;
+    } else {
+        return DumpArea::both;
+    }
+}
+
+DumpColor parse_dump_color(char const* color)
+{
+    if (color == nullptr || strcmp(color, "auto") == 0) {
+        return DumpColor::automatic;
+    } else if (strcmp(color, "always") == 0) {
+        return DumpColor::always;
+    } else if (strcmp(color, "never") == 0) {
+        return DumpColor::never;
+    } else {
+        return DumpColor::automatic;
+    }
+}
+
+// "USR1", "SIGUSR1" or a signal number, 0 when unset or unknown
+int parse_signal(char const* name)
+{
+    if (name == nullptr || *name == '\0') {
+        return 0;
+    }
+    char* end = nullptr;
+    auto const number = strtol(name, &end, 0);
+    if (*end == '\0') {
+        return number > 0 && number < NSIG ? number : 0;
+    }
+    if (strncmp(name, "SIG", 3) == 0) {
+        name += 3;
+    }
+    static constexpr std::pair<char const*, int> known[]{{"HUP", SIGHUP}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2}};
+    for (auto [known_name, signo] : known) {
+        if (strcmp(name, known_name) == 0) {
+            return signo;
+        }
+    }
+    return 0;
+}
+
+// comma separated, empty ones dropped
+std::vector<std::string> parse_patterns(char const* patterns)
+{
+    std::vector<std::string> parsed;
+    for (auto at = patterns; at && *at;) {
+        auto const end = strchrnul(at, ',');
+        if (end != at) {
+            parsed.emplace_back(at, end);
+        }
+        at = *end ? end + 1 : end;
+    }
+    return parsed;
+}
+
+Config parse()
+{
+    Settings const settings;
+    Config config{};
+    config.enabled = !is_no(settings.get("SHST_ENABLED"));
+    config.reaction = parse_reaction(settings.get("SHST_REACTION"));
+    config.check_depth = parse_limit(settings.get("SHST_CHECK_DEPTH"));
+    config.check_bytes = parse_limit(settings.get("SHST_CHECK_BYTES"));
+    auto const rotate = settings.get("SHST_CHECK_ROTATE");
+    config.check_rotate = rotate ? strtoull(rotate, nullptr, 0) : 0;
+    config.check_mode = parse_check_mode(settings.get("SHST_CHECK_MODE"));
+    auto const rate = settings.get("SHST_SAMPLE_RATE");
+    config.sample_rate = rate ? strtoul(rate, nullptr, 0) : 1;
+    auto const copy = settings.get("SHST_FINGERPRINT_COPY");
+    if (is_yes(copy) || is_no(copy)) {
+        config.fingerprint_copy = is_yes(copy);
+    } else {
+        // auto: only keep the copy if it will be needed to heal
+        config.fingerprint_copy = config.reaction == Reaction::report_heal_and_continue ||
+                                  config.reaction == Reaction::heal_and_continue;
+    }
+    config.overhead_budget = parse_overhead_budget(settings.get("SHST_OVERHEAD_BUDGET"));
+    config.dump_width = parse_dump_width(settings.get("SHST_DUMP_WIDTH"));
+    config.dump_area = parse_dump_area(settings.get("SHST_DUMP_AREA"));
+    config.dump_hide_equal = is_yes(settings.get("SHST_DUMP_HIDE_EQUAL"));
+    config.dump_color = parse_dump_color(settings.get("SHST_DUMP_COLOR"));
+    auto const symbolize = settings.get("SHST_SYMBOLIZE");
+    config.symbolize_offline = symbolize && strcmp(symbolize, "offline") == 0;
+    auto const limit = settings.get("SHST_REPORT_LIMIT");
+    config.report_limit = limit ? strtoull(limit, nullptr, 0) : 0;
+    auto const summary = settings.get("SHST_REPORT_SUMMARY");
+    auto const seconds = summary ? strtod(summary, nullptr) : 10.0;
+    config.report_summary_ns = seconds > 0 ? static_cast<uint64_t>(seconds * 1e9) : 0;
+    config.instrument_exclude = parse_patterns(settings.get("SHST_INSTRUMENT_EXCLUDE"));
+    config.shadow_pool = !is_no(settings.get("SHST_SHADOW_POOL"));
+    return config;
+}
+
+std::mutex reload_mutex;
+
+// Signal handlers can't parse anything, so SHST_RELOAD_SIGNAL only wakes up a thread which does the reload.
+sem_t reload_requests;
+
+void on_reload_signal(int)
+{
+    auto const saved_errno = errno;
+    sem_post(&reload_requests);
+    errno = saved_errno;
+}
+
+void* reloader(void*)
+{
+    for (;;) {
+        if (sem_wait(&reload_requests) == 0) {
+            reload_config();
+        }
+    }
+    return nullptr;
+}
+
+void start_reloader(char const* signal_name)
+{
+    auto const signo = parse_signal(signal_name);
+    if (signo == 0) {
+        if (signal_name && *signal_name) {
+            fprintf(stderr, "shadow stack: unknown SHST_RELOAD_SIGNAL %s\n", signal_name);
+        }
+        return;
+    }
+    sem_init(&reload_requests, 0, 0);
+    pthread_t thread;
+    if (auto const error = pthread_create(&thread, nullptr, reloader, nullptr)) {
+        fprintf(stderr, "shadow stack: can't start config reloader (%s)\n", strerror(error));
+        return;
+    }
+    pthread_detach(thread);
+
+    struct sigaction action{};
+    action.sa_handler = on_reload_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(signo, &action, nullptr);
+}
+
+// parsed at load time, so nothing has to be parsed on the way of guarded calls
+[[maybe_unused]] bool const loaded = [] {
+    detail::load_config();
+    start_reloader(getenv("SHST_RELOAD_SIGNAL"));
+    return true;
+}();
+
+} // namespace
+
+Config const& detail::load_config()
+{
+    std::lock_guard lock{reload_mutex};
+    if (auto current = current_config.load(std::memory_order_acquire)) {
+        // somebody else was first
+        return *current;
+    }
+    auto const config = new Config{parse()};
+    enabled.store(config->enabled, std::memory_order_relaxed);
+    current_config.store(config, std::memory_order_release);
+    return *config;
+}
+
+void reload_config()
+{
+    std::lock_guard lock{reload_mutex};
+    // the previous snapshot is intentionally leaked, threads may still be looking at it
+    auto const config = new Config{parse()};
+    detail::enabled.store(config->enabled, std::memory_order_relaxed);
+    detail::current_config.store(config, std::memory_order_release);
+}
+
+} // namespace shst
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shst {
+
+enum class Reaction
+{
+    ignore,
+    report_and_continue,
+    report_and_abort,
+    report_heal_and_continue,
+    heal_and_continue
+};
+
+// keep in sync with enum shst_check_mode
+enum class CheckMode
+{
+    exact,
+    fingerprint,
+    watch,
+    return_address
+};
+
+enum class DumpArea
+{
+    both,
+    actual,
+    shadow
+};
+
+enum class DumpColor
+{
+    automatic,
+    always,
+    never
+};
+
+// Everything read from SHST_* environment variables (and SHST_CONFIG_FILE), parsed once.
+//
+// Snapshots are immutable, a reload publishes a new one and never frees the old ones, so a reference obtained
+// from config() stays valid for good. Check settings are per thread: every thread starts with them and picks up
+// those which changed in a reload on its next guarded call, overriding whatever the per-thread API set before.
+struct Config
+{
+    bool enabled;
+    Reaction reaction;
+    size_t check_depth;
+    size_t check_bytes;
+    size_t check_rotate;
+    CheckMode check_mode;
+    uint32_t sample_rate;
+    // SHST_FINGERPRINT_COPY resolved against the reaction
+    bool fingerprint_copy;
+    double overhead_budget;
+    int dump_width;
+    DumpArea dump_area;
+    bool dump_hide_equal;
+    DumpColor dump_color;
+    // SHST_SYMBOLIZE=offline, reports carry the loaded objects instead of names
+    bool symbolize_offline;
+    // reports made in full per site and thread, 0 means no limit
+    uint64_t report_limit;
+    // how often suppressed reports get summarized
+    uint64_t report_summary_ns;
+    // SHST_INSTRUMENT_EXCLUDE, fnmatch() patterns of functions the -finstrument-functions hooks leave alone
+    std::vector<std::string> instrument_exclude;
+    // SHST_SHADOW_POOL, unless shst_set_shadow_pool_enabled() was called
+    bool shadow_pool;
+};
+
+namespace detail {
+
+extern std::atomic<Config const*> current_config;
+
+Config const& load_config();
+
+} // namespace detail
+
+// current snapshot, loaded when the library is loaded
+inline Config const& config()
+{
+    auto const current = detail::current_config.load(std::memory_order_acquire);
+    return current ? *current : detail::load_config();
+}
+
+// parses the environment (and SHST_CONFIG_FILE) again and publishes the result, also sets the global enable flag
+void reload_config();
+
+} // namespace shst
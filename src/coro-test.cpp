@@ -0,0 +1,230 @@
+#include "shadow-stack-coro.hpp"
+#include "shadow-stack.h"
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <utility>
+
+// Guarded coroutines suspended in the middle of their bodies and resumed from different depths of the stack, a
+// lazily started child task awaited through symmetric transfer, an awaitable which is ready right away and a
+// corruption done by a resumed coroutine, found when it suspends again.
+
+std::deque<std::coroutine_handle<>> ready;
+
+// goes to the back of the queue
+struct yield
+{
+    bool await_ready()
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        ready.push_back(handle);
+    }
+
+    void await_resume()
+    {
+    }
+};
+
+// started right away, nobody waits for it
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object()
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend()
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+// started when awaited, resumes the awaiting coroutine when done
+struct task
+{
+    struct promise_type
+    {
+        int value = 0;
+        std::coroutine_handle<> continuation;
+
+        task get_return_object()
+        {
+            return task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend()
+        {
+            return {};
+        }
+
+        auto final_suspend() noexcept
+        {
+            struct resume_continuation
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    return handle.promise().continuation;
+                }
+
+                void await_resume() noexcept
+                {
+                }
+            };
+            return resume_continuation{};
+        }
+
+        void return_value(int v)
+        {
+            value = v;
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    explicit task(std::coroutine_handle<promise_type> handle)
+        : handle{handle}
+    {
+    }
+
+    task(task&& other) noexcept
+        : handle{std::exchange(other.handle, {})}
+    {
+    }
+
+    ~task()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready()
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation)
+    {
+        handle.promise().continuation = continuation;
+        return handle;
+    }
+
+    int await_resume()
+    {
+        return handle.promise().value;
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+int volatile* victim = nullptr;
+int completed = 0;
+
+task child(int x)
+{
+    shst::co_guard guard{child, x};
+    co_await guard.await(yield{});
+    co_return x + 1;
+}
+
+detached worker(int id, bool corrupt)
+{
+    shst::co_guard guard{worker, id, corrupt};
+    int sum = 0;
+    for (int i = 0; i < 4; ++i) {
+        co_await guard.await(yield{});
+        if (corrupt && i == 2) {
+            // belongs to whoever resumed us, so to the frame pushed on resumption
+            *victim = *victim + 1;
+        }
+        sum += co_await guard.await(child(i));
+        co_await guard.await(std::suspend_never{});
+    }
+    completed += sum == 10;
+}
+
+// resumes the next coroutine from `depth` guarded calls deep
+int run_one(int depth)
+{
+    int volatile local[16]{depth};
+    if (depth > 0) {
+        return shst::invoke(run_one, depth - 1) + local[0];
+    }
+    victim = local;
+    auto const handle = ready.front();
+    ready.pop_front();
+    handle.resume();
+    return local[0];
+}
+
+void run_all()
+{
+    for (int turn = 0; !ready.empty(); ++turn) {
+        shst::invoke(run_one, turn % 5);
+    }
+}
+
+unsigned long long stat(unsigned long long shst_stats::*counter)
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats.*counter;
+}
+
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+int main()
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    for (int id = 0; id < 3; ++id) {
+        worker(id, false);
+    }
+    run_all();
+    expect(completed == 3, "coroutines completed");
+    expect(stat(&shst_stats::failed_checks) == 0, "no false positives across suspensions");
+
+    worker(3, true);
+    run_all();
+    expect(stat(&shst_stats::failed_checks) != 0, "corruption by a resumed coroutine found");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+#include "compare.hpp"
+#include "memory-printer.hpp"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Rendering the hex dump of a 1 MB stack diff (a few bytes differing in every page and one page differing entirely)
+// in the ways reports print it. Output goes unbuffered, like stderr, to /dev/null or to the file given (to compare it
+// with other builds).
+
+int main(int argc, char** argv)
+{
+    size_t const size = 1 << 20;
+    std::vector<uint8_t> actual(size), shadow(size);
+    for (size_t i = 0; i < size; ++i) {
+        actual[i] = shadow[i] = static_cast<uint8_t>(i * 31 + (i >> 8));
+    }
+    for (size_t i = 100; i < size; i += 4096) {
+        for (size_t j = i; j < i + 8; ++j) {
+            actual[j] ^= 0x40;
+        }
+    }
+    for (size_t i = size / 2; i < size / 2 + 4096; ++i) {
+        actual[i] = 0;
+    }
+    shst::DiffRanges ranges;
+    shst::compare(actual.data(), shadow.data(), size, ranges);
+
+    auto const out = fopen(argc > 1 ? argv[1] : "/dev/null", "w");
+    if (out == nullptr) {
+        perror("fopen");
+        return 1;
+    }
+    setvbuf(out, nullptr, _IONBF, 0);
+
+    struct Case
+    {
+        char const* name;
+        bool hide_equal;
+        bool color;
+        shst::DumpArea area;
+    };
+    Case const cases[]{{"both", false, false, shst::DumpArea::both},
+                       {"both, color", false, true, shst::DumpArea::both},
+                       {"both, hide equal", true, false, shst::DumpArea::both},
+                       {"actual", false, false, shst::DumpArea::actual}};
+
+    printf("%-20s %12s   [1 MB, %zu differences]\n", "", "ms per dump", ranges.size());
+    for (auto const& c : cases) {
+        shst::MemoryPrinter printer(16, c.hide_equal, c.area, c.color);
+        printer.set_diff(&ranges, actual.data());
+        int const iterations = argc > 1 ? 1 : 3;
+        auto const start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            printer.print_header();
+            printer.dump(actual.data(), shadow.data(), size);
+            printer.flush(out);
+        }
+        fflush(out);
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        printf("%-20s %12.1f\n", c.name, std::chrono::duration<double, std::milli>(elapsed).count() / iterations);
+    }
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+// A loop of guarded calls at the same depth: every pre-call check but the first one is covered by the post-return
+// check of the call before. Corrupting an older frame between two such calls still has to be found by the very
+// next call. With a check depth of one frame the post-return check covers nothing older, so nothing is elided.
+
+constexpr int calls = 100;
+
+int leaf(int x)
+{
+    return x + 1;
+}
+
+bool elided = false;
+bool found = false;
+bool none_elided = false;
+
+int loop(int volatile* victim)
+{
+    shst_stats before, now;
+    shst_get_thread_stats(&before);
+    for (int i = 0; i < calls; ++i) {
+        shst::invoke(leaf, i);
+    }
+    shst_get_thread_stats(&now);
+    elided = now.elided_checks - before.elided_checks == calls - 1 && now.failed_checks == before.failed_checks;
+
+    *victim += 1;
+    shst::invoke(leaf, 0);
+    shst_get_thread_stats(&now);
+    found = now.failed_checks != before.failed_checks;
+    *victim -= 1;
+
+    shst_set_check_depth(1);
+    shst_get_thread_stats(&before);
+    for (int i = 0; i < calls; ++i) {
+        shst::invoke(leaf, i);
+    }
+    shst_get_thread_stats(&now);
+    none_elided = now.elided_checks == before.elided_checks;
+    shst_set_check_depth(SHST_CHECK_FULL);
+    return 0;
+}
+
+int outer()
+{
+    int volatile local[16]{};
+    return shst::invoke(loop, local) + local[0];
+}
+
+int main()
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    shst::invoke(outer);
+
+    printf("elided all but the first of %d pre-call checks: %s, corruption found: %s, none elided at depth 1: %s\n",
+           calls,
+           elided ? "yes" : "no",
+           found ? "yes" : "no",
+           none_elided ? "yes" : "no");
+    return elided && found && none_elided ? 0 : 1;
+}
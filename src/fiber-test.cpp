@@ -0,0 +1,162 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ucontext.h>
+#include <vector>
+
+// Guarded calls on stacks other than the thread's own one: fibers which switch away in the middle of guarded
+// calls and get corrupted while suspended, a signal handler on the alternate signal stack and a fiber whose stack
+// nobody registered.
+
+constexpr size_t stack_size = 256 * 1024;
+
+ucontext_t main_context;
+
+struct Fiber
+{
+    ucontext_t context;
+    std::vector<char> stack = std::vector<char>(stack_size);
+    shst_stack* registered = nullptr;
+    int volatile* local = nullptr;
+
+    void start(void (*body)())
+    {
+        getcontext(&context);
+        context.uc_stack.ss_sp = stack.data();
+        context.uc_stack.ss_size = stack.size();
+        context.uc_link = &main_context;
+        makecontext(&context, body, 0);
+    }
+
+    void resume()
+    {
+        shst_stack_switch(registered);
+        swapcontext(&main_context, &context);
+        shst_stack_switch(nullptr);
+    }
+};
+
+Fiber fibers[2];
+Fiber* running;
+
+void yield()
+{
+    swapcontext(&running->context, &main_context);
+}
+
+int leaf(int x)
+{
+    return x + 1;
+}
+
+int nested(int level)
+{
+    int volatile local[16]{level};
+    if (level == 0) {
+        yield();
+        return local[0];
+    }
+    if (level == 1) {
+        // part of the shadow frame pushed for the call below
+        running->local = local;
+    }
+    return shst::invoke(nested, level - 1) + local[0];
+}
+
+void body()
+{
+    for (int i = 0; i < 3; ++i) {
+        shst::invoke(nested, 4);
+    }
+}
+
+unsigned long long stat(unsigned long long shst_stats::*counter)
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats.*counter;
+}
+
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+void run_until_done(bool corrupt)
+{
+    for (int round = 0; round < 4; ++round) {
+        for (auto& fiber : fibers) {
+            running = &fiber;
+            fiber.resume();
+            if (corrupt && round == 1 && &fiber == &fibers[0]) {
+                // suspended deep in guarded calls
+                *fiber.local += 1;
+            }
+        }
+    }
+}
+
+void on_signal(int)
+{
+    shst::invoke(leaf, 0);
+}
+
+int main()
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    for (auto& fiber : fibers) {
+        fiber.registered = shst_stack_register(fiber.stack.data(), fiber.stack.size());
+        fiber.start(body);
+    }
+    expect(fibers[0].registered && fibers[1].registered, "fiber stacks registered");
+    expect(!shst_stack_register(fibers[0].stack.data() + 4096, 4096), "overlapping stack refused");
+
+    auto const calls = stat(&shst_stats::calls);
+    run_until_done(false);
+    expect(stat(&shst_stats::calls) - calls == 2 * 3 * 5, "fibers switching inside guarded calls");
+    expect(stat(&shst_stats::failed_checks) == 0, "no false positives");
+
+    for (auto& fiber : fibers) {
+        fiber.start(body);
+    }
+    run_until_done(true);
+    expect(stat(&shst_stats::failed_checks) != 0, "corruption of a suspended fiber found");
+
+    for (auto& fiber : fibers) {
+        expect(shst_stack_unregister(fiber.registered) == 0, "idle fiber stack unregistered");
+    }
+
+    // with its stack no longer known the fiber runs unchecked
+    auto const before = stat(&shst_stats::calls);
+    running = &fibers[0];
+    fibers[0].start(body);
+    for (int i = 0; i < 4; ++i) {
+        swapcontext(&main_context, &fibers[0].context);
+    }
+    expect(stat(&shst_stats::calls) == before, "unknown stack not checked");
+
+    std::vector<char> alternate(stack_size);
+    stack_t ss{};
+    ss.ss_sp = alternate.data();
+    ss.ss_size = alternate.size();
+    sigaltstack(&ss, nullptr);
+    shst_thread_attach();
+    struct sigaction action{};
+    action.sa_handler = on_signal;
+    action.sa_flags = SA_ONSTACK;
+    sigaction(SIGUSR1, &action, nullptr);
+    auto const failed = stat(&shst_stats::failed_checks);
+    auto const calls_before_signal = stat(&shst_stats::calls);
+    raise(SIGUSR1);
+    expect(stat(&shst_stats::calls) != calls_before_signal && stat(&shst_stats::failed_checks) == failed,
+           "guarded call on the alternate signal stack");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+#include "fingerprint.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace shst {
+
+namespace {
+
+uint64_t load64(uint8_t const* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// two independent lanes to hide multiply latency
+uint64_t fingerprint_multiply(uint8_t const* data, size_t size)
+{
+    constexpr uint64_t k0 = 0x9e3779b97f4a7c15ULL;
+    constexpr uint64_t k1 = 0xbf58476d1ce4e5b9ULL;
+    uint64_t h0 = size * k0;
+    uint64_t h1 = ~size * k1;
+
+    auto p = data;
+    auto const end = data + size;
+    for (; end - p >= 16; p += 16) {
+        h0 = rotl(h0 ^ (load64(p) * k1), 31) * k0;
+        h1 = rotl(h1 ^ (load64(p + 8) * k0), 29) * k1;
+    }
+    if (end - p >= 8) {
+        h0 = rotl(h0 ^ (load64(p) * k1), 31) * k0;
+        p += 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, end - p);
+    h1 = rotl(h1 ^ (tail * k0), 29) * k1;
+
+    return mix(h0 ^ rotl(h1, 17));
+}
+
+#if defined(__x86_64__)
+// three independent CRC streams, crc32 has a latency of three cycles but a throughput of one
+__attribute__((target("sse4.2"))) uint64_t fingerprint_crc32c(uint8_t const* data, size_t size)
+{
+    uint64_t c0 = ~uint32_t{0};
+    uint64_t c1 = 0;
+    uint64_t c2 = 0;
+
+    auto p = data;
+    auto const end = data + size;
+    for (; end - p >= 24; p += 24) {
+        c0 = _mm_crc32_u64(c0, load64(p));
+        c1 = _mm_crc32_u64(c1, load64(p + 8));
+        c2 = _mm_crc32_u64(c2, load64(p + 16));
+    }
+    for (; end - p >= 8; p += 8) {
+        c0 = _mm_crc32_u64(c0, load64(p));
+    }
+    for (; p < end; ++p) {
+        c0 = _mm_crc32_u8(c0, *p);
+    }
+
+    return (c0 << 32 | c1) ^ rotl(c2, 16) ^ size;
+}
+#endif
+
+using fingerprint_f = uint64_t (*)(uint8_t const*, size_t);
+
+fingerprint_f select_fingerprint()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return fingerprint_crc32c;
+    }
+#endif
+    return fingerprint_multiply;
+}
+
+} // namespace
+
+uint64_t fingerprint(uint8_t const* data, size_t size)
+{
+    // function-local so that guarded calls made from static initializers of other objects work too
+    static fingerprint_f const fingerprint_impl = select_fingerprint();
+    return fingerprint_impl(data, size);
+}
+
+} // namespace shst
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace shst {
+
+// Fast, non-cryptographic fingerprint of a memory area.
+//
+// Uses hardware CRC32C when the CPU has it (SSE4.2) and a multiply-based hash otherwise, the implementation is
+// chosen once per process, so fingerprints stay comparable for its whole lifetime.
+uint64_t fingerprint(uint8_t const* data, size_t size);
+
+} // namespace shst
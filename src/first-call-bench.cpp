@@ -0,0 +1,125 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Latency of the very first guarded call of a thread, with the thread set up as part of that call and with
+// shst_thread_attach() done as the thread started. The main thread is measured in forked children, it is the
+// one for which glibc parses /proc/self/maps to find the stack.
+
+using clock_type = std::chrono::steady_clock;
+
+int leaf(unsigned* data)
+{
+    return data[0] + 1;
+}
+
+int deep(unsigned* data)
+{
+    std::array<unsigned, 4 * 1024> local;
+    local[0] = data[0];
+    local.back() = data[0];
+    return shst::invoke(leaf, local.data());
+}
+
+double first_call_us(bool attach)
+{
+    if (attach) {
+        shst_thread_attach();
+    }
+    std::array<unsigned, 64> data{};
+    auto const start = clock_type::now();
+    shst::invoke(deep, data.data());
+    return std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+}
+
+void* worker(void* attach)
+{
+    static_assert(sizeof(double) <= sizeof(void*));
+    auto const us = first_call_us(attach != nullptr);
+    void* result;
+    __builtin_memcpy(&result, &us, sizeof(us));
+    return result;
+}
+
+struct Summary
+{
+    double median;
+    double max;
+};
+
+Summary summarize(std::vector<double>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2], samples.back()};
+}
+
+Summary threads(int count, bool attach)
+{
+    std::vector<double> samples;
+    for (int i = 0; i < count; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, worker, reinterpret_cast<void*>(uintptr_t{attach})) != 0) {
+            perror("pthread_create");
+            exit(2);
+        }
+        void* result;
+        pthread_join(thread, &result);
+        double us;
+        __builtin_memcpy(&us, &result, sizeof(us));
+        samples.push_back(us);
+    }
+    return summarize(samples);
+}
+
+Summary main_threads(int count, bool attach)
+{
+    std::vector<double> samples;
+    for (int i = 0; i < count; ++i) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            perror("pipe");
+            exit(2);
+        }
+        auto const child = fork();
+        if (child == 0) {
+            auto const us = first_call_us(attach);
+            auto const written = write(fds[1], &us, sizeof(us));
+            _exit(written == sizeof(us) ? 0 : 1);
+        }
+        double us = 0;
+        if (read(fds[0], &us, sizeof(us)) != sizeof(us)) {
+            fprintf(stderr, "child failed\n");
+            exit(2);
+        }
+        waitpid(child, nullptr, 0);
+        close(fds[0]);
+        close(fds[1]);
+        samples.push_back(us);
+    }
+    return summarize(samples);
+}
+
+void print(char const* what, Summary summary)
+{
+    printf("%-28s median %8.1f us, max %8.1f us\n", what, summary.median, summary.max);
+}
+
+int main(int argc, char* argv[])
+{
+    int const count = argc > 1 ? atoi(argv[1]) : 200;
+
+    // nothing guarded may run in this process before the children are forked
+    print("main thread:", main_threads(count, false));
+    print("main thread, attached:", main_threads(count, true));
+    print("new thread:", threads(count, false));
+    print("new thread, attached:", threads(count, true));
+}
@@ -0,0 +1,71 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <alloca.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// A deep stack of big frames with a bit of real work in every call makes full checks cost far more than the
+// budget. The governor has to find settings which bring the overhead under it, and give the configured settings
+// back once the budget gets generous again.
+
+constexpr double budget = 0.05;
+constexpr int depth = 16;
+constexpr size_t frame = 16384;
+
+volatile uint64_t sink;
+
+int nested(int level)
+{
+    auto local = static_cast<uint8_t volatile*>(alloca(frame));
+    local[0] = level;
+    if (level == 0) {
+        uint64_t x = 1;
+        for (int i = 0; i < 300000; ++i) {
+            x = x * 6364136223846793005 + 1442695040888963407;
+        }
+        sink = x;
+        return local[0];
+    }
+    return shst::invoke(nested, level - 1) + local[0];
+}
+
+void run_for(std::chrono::milliseconds duration)
+{
+    auto const end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+        for (int i = 0; i < 16; ++i) {
+            sink = sink + shst::invoke(nested, depth);
+        }
+    }
+}
+
+void print(char const* when, shst_governor_state const& state)
+{
+    printf("%-24s budget %5.1f%%, overhead %5.1f%%, level %2u, check depth %3llu, sample rate %u\n",
+           when,
+           state.budget * 100,
+           state.overhead * 100,
+           state.level,
+           state.check_depth,
+           state.sample_rate);
+}
+
+int main()
+{
+    shst_governor_state loaded, relaxed;
+
+    shst_set_overhead_budget(budget);
+    run_for(std::chrono::milliseconds(500));
+    shst_get_governor_state(&loaded);
+    print("under load:", loaded);
+
+    shst_set_overhead_budget(0.99);
+    run_for(std::chrono::milliseconds(200));
+    shst_get_governor_state(&relaxed);
+    print("with generous budget:", relaxed);
+
+    auto const settled = loaded.level > 0 && loaded.check_depth != 0 && loaded.overhead <= budget * 2;
+    auto const restored = relaxed.level == 0 && relaxed.check_depth == 0 && relaxed.sample_rate == 1;
+    return settled && restored ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#include "governor.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace shst {
+
+namespace {
+
+// depth used by the first level, every further level halves it
+constexpr size_t first_depth = 32;
+constexpr unsigned depth_levels = 6;
+
+} // namespace
+
+Governor::Governor(double budget)
+{
+    set_budget(budget);
+}
+
+void Governor::set_budget(double budget)
+{
+    budget_ = budget > 0 ? budget : 0;
+    overhead_ = 0;
+    level_ = 0;
+    spent_ = 0;
+    window_start = 0;
+}
+
+bool Governor::end_window(uint64_t now)
+{
+    auto const elapsed = now - window_start;
+    auto const first = window_start == 0;
+    window_start = now;
+    auto const spent = spent_;
+    spent_ = 0;
+    if (first) {
+        // nothing measured yet, window just started
+        return false;
+    }
+
+    overhead_ = double(spent) / double(elapsed);
+    if (overhead_ > budget_ && level_ < max_level) {
+        ++level_;
+        return true;
+    }
+    if (overhead_ < budget_ / 2 && level_ > 0) {
+        --level_;
+        return true;
+    }
+    return false;
+}
+
+Governor::Settings Governor::settings(Settings base) const
+{
+    if (level_ == 0) {
+        return base;
+    }
+    auto settings = base;
+    auto const depth = first_depth >> std::min(level_ - 1, depth_levels - 1);
+    if (!settings.check_depth || settings.check_depth > depth) {
+        settings.check_depth = depth;
+    }
+    if (level_ > depth_levels) {
+        auto const rate = uint64_t{std::max<uint32_t>(base.sample_rate, 1)} << (level_ - depth_levels);
+        settings.sample_rate = std::min<uint64_t>(rate, UINT32_MAX);
+    }
+    return settings;
+}
+
+double parse_overhead_budget(char const* budget)
+{
+    if (budget == nullptr) {
+        return 0;
+    }
+    char* end = nullptr;
+    auto value = strtod(budget, &end);
+    if (end == budget || value <= 0) {
+        return 0;
+    }
+    // "3%" and "3" are both percent, "0.03" is a fraction
+    if (*end == '%' || value >= 1) {
+        value /= 100;
+    }
+    return value;
+}
+
+} // namespace shst
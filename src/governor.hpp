@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace shst {
+
+// cheap monotonic timestamp, TSC ticks where available
+inline uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// Keeps the time a thread spends in the shadow stack under a budget (a fraction of wall time).
+//
+// Time spent is accumulated per window of wall time. At the end of every window the overhead is compared with the
+// budget: over budget makes checks cheaper by one level, under half of the budget makes them more thorough by
+// one level. Level 0 is whatever got configured, the following levels first cut check depth down to a single
+// frame and then sample fewer and fewer calls.
+class Governor
+{
+  public:
+    struct Settings
+    {
+        size_t check_depth;
+        uint32_t sample_rate;
+    };
+
+    static constexpr unsigned max_level = 16;
+
+    explicit Governor(double budget = 0);
+
+    // 0 turns the governor off
+    void set_budget(double budget);
+
+    [[nodiscard]] bool enabled() const noexcept
+    {
+        return budget_ > 0;
+    }
+
+    [[nodiscard]] double budget() const noexcept
+    {
+        return budget_;
+    }
+
+    [[nodiscard]] double overhead() const noexcept
+    {
+        return overhead_;
+    }
+
+    [[nodiscard]] unsigned level() const noexcept
+    {
+        return level_;
+    }
+
+    // `spent` ticks ending `now` were spent in the shadow stack, returns true when the level changed
+    [[nodiscard]] bool account(uint64_t spent, uint64_t now)
+    {
+        spent_ += spent;
+        return now - window_start >= window ? end_window(now) : false;
+    }
+
+    // what to apply at the current level, given the configured settings
+    [[nodiscard]] Settings settings(Settings base) const;
+
+  private:
+    [[nodiscard]] bool end_window(uint64_t now);
+
+    // a few milliseconds worth of TSC ticks
+    static constexpr uint64_t window = uint64_t{1} << 24;
+
+    double budget_;
+    double overhead_{};
+    unsigned level_{};
+    uint64_t spent_{};
+    uint64_t window_start{};
+};
+
+// parses "3%", "3" (percent as well) or "0.03", 0 when unset or invalid
+double parse_overhead_budget(char const* budget);
+
+} // namespace shst
@@ -0,0 +1,76 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <alloca.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+
+// Cost of a guarded call in the default (exact) mode at a few check depths, with push and pre-call check fused and, for
+// comparison, one after the other (the new frame read twice, and nothing the post-return check of the previous call
+// verified is left out either). A stack of `depth` guarded frames of the given size is built once, then the newest of
+// them makes guarded calls of a leaf function in a loop, each one pushing a frame of the same size. Best of a few runs,
+// to keep the noise out. Last, the cost of a guarded call with the library disabled.
+
+constexpr int depth = 8;
+
+volatile int sink;
+
+int leaf(size_t frame)
+{
+    auto local = static_cast<uint8_t volatile*>(alloca(frame));
+    local[0] = 1;
+    local[frame - 1] = 1;
+    return local[0];
+}
+
+double ns_per_call(int level, size_t frame)
+{
+    auto local = static_cast<uint8_t volatile*>(alloca(frame));
+    local[0] = level;
+    if (level < depth) {
+        return shst::invoke(ns_per_call, level + 1, frame) + local[0] * 0.0;
+    }
+    auto const iterations = std::max<size_t>(64, (size_t{64} << 20) / (frame * depth));
+    double best = 1e300;
+    for (int run = 0; run < 5; ++run) {
+        auto const start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            sink = shst::invoke(leaf, frame);
+        }
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+    }
+    return best;
+}
+
+int main()
+{
+    size_t const check_depths[]{SHST_CHECK_FULL, 4, 1};
+
+    printf("%10s", "");
+    for (auto check_depth : check_depths) {
+        printf("   %20s %2zu", "check depth", check_depth);
+    }
+    printf("\n%10s", "frame");
+    for (size_t i = 0; i < std::size(check_depths); ++i) {
+        printf(" %12s %12s", "fused", "unfused");
+    }
+    printf("   [ns per call, %d frames of the same size below]\n", depth);
+
+    for (size_t frame = 256; frame <= 64 * 1024; frame *= 4) {
+        printf("%10zu", frame);
+        for (auto check_depth : check_depths) {
+            shst_set_check_depth(check_depth);
+            for (bool fused : {true, false}) {
+                shst::detail::set_fused_push_check(fused);
+                printf(" %12.1f", shst::invoke(ns_per_call, 0, frame));
+            }
+        }
+        printf("\n");
+    }
+    shst::detail::set_fused_push_check(true);
+
+    shst_set_enabled(0);
+    printf("disabled: %.1f ns per call of the 256 byte frame\n", ns_per_call(0, 256));
+}
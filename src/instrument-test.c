@@ -0,0 +1,104 @@
+#include "shadow-stack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Calls guarded by the -finstrument-functions hooks (this file is built with the flag): every call of a function of
+// it, corruption found, functions matching SHST_INSTRUMENT_EXCLUDE and everything while disabled left alone. Then the
+// cost of a call in each case. Helpers are kept out of the instrumentation not to count their calls.
+
+#define HELPER __attribute__((no_instrument_function))
+
+__attribute__((noinline)) int leaf(int x)
+{
+    return x + 1;
+}
+
+__attribute__((noinline)) int excluded_leaf(int x)
+{
+    return x + 2;
+}
+
+__attribute__((noinline)) int middle(int x)
+{
+    return leaf(x) * 2;
+}
+
+__attribute__((noinline)) void overrun(int volatile* victim)
+{
+    *victim += 1;
+}
+
+int failures = 0;
+
+HELPER void expect(int ok, char const* what)
+{
+    printf("%-40s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+HELPER shst_stats stats(void)
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats;
+}
+
+HELPER double now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+HELPER double ns_per_call(int (*f)(int))
+{
+    int const iterations = 1 << 18;
+    double const start = now_ns();
+    int volatile sink = 0;
+    for (int i = 0; i < iterations; ++i) {
+        sink += f(i);
+    }
+    return (now_ns() - start) / iterations;
+}
+
+__attribute__((noinline)) int outer(void)
+{
+    int volatile local[4] = {0};
+
+    unsigned long long const calls = stats().calls;
+    expect(middle(1) == 4 && stats().calls == calls + 2, "calls guarded");
+    expect(stats().failed_checks == 0, "no corruption");
+    overrun(&local[2]);
+    expect(stats().calls == calls + 3 && stats().failed_checks == 1, "corruption found");
+    local[2] -= 1;
+
+    setenv("SHST_INSTRUMENT_EXCLUDE", "excluded_*,other", 1);
+    shst_reload_config();
+    expect(excluded_leaf(1) == 3 && leaf(1) == 2 && stats().calls == calls + 4, "excluded not guarded");
+
+    shst_set_enabled(0);
+    expect(middle(1) == 4 && stats().calls == calls + 4, "disabled, not guarded");
+    shst_set_enabled(1);
+    expect(middle(1) == 4 && stats().calls == calls + 6, "enabled again, guarded");
+
+    shst_set_check_depth(1);
+    double const guarded = ns_per_call(leaf);
+    double const excluded = ns_per_call(excluded_leaf);
+    shst_set_enabled(0);
+    double const disabled = ns_per_call(leaf);
+    shst_set_enabled(1);
+    printf("ns per call: guarded %.1f, excluded %.1f, disabled %.1f\n", guarded, excluded, disabled);
+
+    return local[0];
+}
+
+int main(void)
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    outer();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+#include "config.hpp"
+#include "shadow-stack.hpp"
+#include "symbolizer.hpp"
+
+#include <cstdint>
+#include <fnmatch.h>
+#include <unordered_map>
+#include <vector>
+
+// Optional -finstrument-functions hooks, link it with code built with -finstrument-functions (linking the
+// shst-instrument target adds the flags) to have every call of a function of that code guarded, no source changes.
+//
+// A function's frame starts where its caller's stack pointer was at the call, found through the frame pointer of the
+// function, so instrumented code needs frame pointers too. Functions inlined into another get no frame of their own.
+// Writes of stack arguments by the function itself are taken for corruption (shst_trampoline() passes a copy, the
+// hooks can't), and so are writes to a struct it returns in memory. longjmp() past instrumented functions is not
+// supported.
+
+namespace shst {
+
+namespace {
+
+struct Entered
+{
+    void* function;
+    void* stack_pointer;
+    bool active;
+};
+
+struct Instrumented
+{
+    // set while the hooks run, whatever gets called from there is not instrumented
+    bool busy;
+    // functions entered and not yet exited, with a shadow frame pushed or inlined into one
+    std::vector<Entered> entered;
+    // by function, whether SHST_INSTRUMENT_EXCLUDE of `applied` matches its name
+    std::unordered_map<void*, bool> excluded;
+    Config const* applied;
+};
+
+thread_local Instrumented instrumented;
+
+__attribute__((no_instrument_function)) bool is_excluded(Instrumented& state, void* function)
+{
+    auto const& current = config();
+    if (current.instrument_exclude.empty()) {
+        return false;
+    }
+    if (&current != state.applied) {
+        state.excluded.clear();
+        state.applied = &current;
+    }
+    auto found = state.excluded.find(function);
+    if (found == state.excluded.end()) {
+        auto const name = Symbolizer::instance().symbol(function);
+        auto matches = false;
+        for (auto const& pattern : current.instrument_exclude) {
+            matches = matches || fnmatch(pattern.c_str(), name.c_str(), 0) == 0;
+        }
+        found = state.excluded.emplace(function, matches).first;
+    }
+    return found->second;
+}
+
+// the stack pointer of the caller of the instrumented function right before the call
+__attribute__((no_instrument_function, always_inline)) inline void* caller_stack_pointer(void* hook_frame)
+{
+    // saved by the hook: the frame pointer of the instrumented function, right below its return address
+    return *static_cast<uint8_t**>(hook_frame) + 2 * sizeof(void*);
+}
+
+} // namespace
+
+} // namespace shst
+
+extern "C" __attribute__((no_instrument_function, noinline)) void __cyg_profile_func_enter(void* function, void*)
+{
+    using namespace shst;
+    if (!detail::enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    auto& state = instrumented;
+    if (state.busy) {
+        return;
+    }
+    state.busy = true;
+    if (!is_excluded(state, function)) {
+        auto const stack_pointer = caller_stack_pointer(__builtin_frame_address(0));
+        // inlined, the frame is the one of the function it got inlined into
+        auto const inlined = !state.entered.empty() && stack_pointer >= state.entered.back().stack_pointer;
+        if (inlined) {
+            state.entered.push_back({function, stack_pointer, false});
+        } else if (detail::enter(function, stack_pointer)) {
+            state.entered.push_back({function, stack_pointer, true});
+        }
+    }
+    state.busy = false;
+}
+
+extern "C" __attribute__((no_instrument_function, noinline)) void __cyg_profile_func_exit(void* function, void*)
+{
+    using namespace shst;
+    auto& state = instrumented;
+    if (state.busy || state.entered.empty()) {
+        return;
+    }
+    auto const stack_pointer = caller_stack_pointer(__builtin_frame_address(0));
+    auto const last = state.entered.back();
+    // not entered (excluded, disabled at the time), whatever is on top belongs to a caller
+    if (last.function != function || last.stack_pointer != stack_pointer) {
+        return;
+    }
+    state.busy = true;
+    state.entered.pop_back();
+    // whatever the switch says by now, a pushed frame has to be popped
+    if (last.active) {
+        detail::leave(stack_pointer);
+    }
+    state.busy = false;
+}
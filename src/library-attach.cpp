@@ -0,0 +1,368 @@
+#include "library-attach.hpp"
+#include "shadow-stack.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <dlfcn.h>
+#include <fnmatch.h>
+#include <link.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace shst {
+
+#if defined(__x86_64__)
+
+namespace {
+
+struct LoadedObject
+{
+    std::string name;
+    ElfW(Addr) base;
+    ElfW(Dyn) const* dynamic;
+    ElfW(Phdr) const* headers;
+    ElfW(Half) header_count;
+};
+
+struct Patch
+{
+    void** slot;
+    void* original;
+    void* trampoline;
+    bool read_only;
+};
+
+// movabs $callee, %r10; mov $stack_bytes, %r11d; jmp *0(%rip); .quad shst_trampoline_sized; int3 up to the next one
+constexpr size_t trampoline_size = 32;
+
+std::mutex mutex;
+// by the name the library was loaded by
+std::map<std::string, std::vector<Patch>> attached;
+// of every callee ever attached, by callee and bytes of stack arguments, never unmapped
+std::map<std::pair<void*, uint32_t>, void*> trampolines;
+
+uintptr_t page_size()
+{
+    static auto const size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+std::vector<LoadedObject> loaded_objects()
+{
+    std::vector<LoadedObject> objects;
+    // only collected here, dlsym() and dladdr() are not for the loader lock held during the walk
+    dl_iterate_phdr(
+            [](dl_phdr_info* info, size_t, void* data) {
+                auto& objects = *static_cast<std::vector<LoadedObject>*>(data);
+                for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+                    if (info->dlpi_phdr[i].p_type == PT_DYNAMIC) {
+                        objects.push_back({info->dlpi_name ? info->dlpi_name : "",
+                                           info->dlpi_addr,
+                                           reinterpret_cast<ElfW(Dyn) const*>(info->dlpi_addr +
+                                                                              info->dlpi_phdr[i].p_vaddr),
+                                           info->dlpi_phdr,
+                                           info->dlpi_phnum});
+                    }
+                }
+                return 0;
+            },
+            &objects);
+    return objects;
+}
+
+bool is_library(std::string const& name, char const* library)
+{
+    if (name == library) {
+        return true;
+    }
+    auto const slash = name.rfind('/');
+    return slash != std::string::npos && name.compare(slash + 1, std::string::npos, library) == 0;
+}
+
+bool contains(LoadedObject const& object, void const* address)
+{
+    auto const at = reinterpret_cast<ElfW(Addr)>(address);
+    for (ElfW(Half) i = 0; i < object.header_count; ++i) {
+        auto const& header = object.headers[i];
+        if (header.p_type == PT_LOAD && at - (object.base + header.p_vaddr) < header.p_memsz) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// RELRO pages go read-only once relocated, with BIND_NOW the whole GOT does
+bool is_read_only(LoadedObject const& object, void** slot)
+{
+    auto const page = reinterpret_cast<uintptr_t>(slot) & ~(page_size() - 1);
+    for (ElfW(Half) i = 0; i < object.header_count; ++i) {
+        auto const& header = object.headers[i];
+        if (header.p_type == PT_GNU_RELRO) {
+            auto const begin = (object.base + header.p_vaddr) & ~(page_size() - 1);
+            auto const end = (object.base + header.p_vaddr + header.p_memsz) & ~(page_size() - 1);
+            if (page >= begin && page < end) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool write_slot(void** slot, void* value, bool read_only)
+{
+    if (!read_only) {
+        __atomic_store_n(slot, value, __ATOMIC_RELEASE);
+        return true;
+    }
+    auto const page = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(slot) & ~(page_size() - 1));
+    if (mprotect(page, page_size(), PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    __atomic_store_n(slot, value, __ATOMIC_RELEASE);
+    mprotect(page, page_size(), PROT_READ);
+    return true;
+}
+
+// glibc relocates addresses in the dynamic section as it loads an object, others (musl) leave them as they are
+template <typename T>
+T const* dynamic_pointer(LoadedObject const& object, ElfW(Addr) address)
+{
+    return reinterpret_cast<T const*>(address < object.base ? object.base + address : address);
+}
+
+// f(slot, name) for every GOT entry of `object` a function gets called through: PLT entries, and with `got_calls` GOT
+// entries of functions, which code built with -fno-plt calls through and taking a function's address reads
+template <typename F>
+void for_each_function_slot(LoadedObject const& object, bool got_calls, F&& f)
+{
+    ElfW(Sym) const* symbols = nullptr;
+    char const* names = nullptr;
+    ElfW(Addr) plt = 0, rela = 0;
+    size_t plt_size = 0, rela_size = 0;
+    bool plt_rela = true;
+    for (auto entry = object.dynamic; entry->d_tag != DT_NULL; ++entry) {
+        switch (entry->d_tag) {
+            case DT_SYMTAB:
+                symbols = dynamic_pointer<ElfW(Sym)>(object, entry->d_un.d_ptr);
+                break;
+            case DT_STRTAB:
+                names = dynamic_pointer<char>(object, entry->d_un.d_ptr);
+                break;
+            case DT_JMPREL:
+                plt = entry->d_un.d_ptr;
+                break;
+            case DT_PLTRELSZ:
+                plt_size = entry->d_un.d_val;
+                break;
+            case DT_PLTREL:
+                plt_rela = entry->d_un.d_val == DT_RELA;
+                break;
+            case DT_RELA:
+                rela = entry->d_un.d_ptr;
+                break;
+            case DT_RELASZ:
+                rela_size = entry->d_un.d_val;
+                break;
+        }
+    }
+    if (symbols == nullptr || names == nullptr) {
+        return;
+    }
+    auto const visit = [&](ElfW(Addr) table, size_t size) {
+        auto const relocations = dynamic_pointer<ElfW(Rela)>(object, table);
+        for (size_t i = 0; i < size / sizeof(ElfW(Rela)); ++i) {
+            auto const type = ELF64_R_TYPE(relocations[i].r_info);
+            auto const index = ELF64_R_SYM(relocations[i].r_info);
+            auto const& symbol = symbols[index];
+            if (index != 0 && (type == R_X86_64_JUMP_SLOT ||
+                               (got_calls && type == R_X86_64_GLOB_DAT && ELF64_ST_TYPE(symbol.st_info) == STT_FUNC))) {
+                f(reinterpret_cast<void**>(object.base + relocations[i].r_offset), names + symbol.st_name);
+            }
+        }
+    };
+    if (plt != 0 && plt_rela) {
+        visit(plt, plt_size);
+    }
+    if (rela != 0) {
+        visit(rela, rela_size);
+    }
+}
+
+// function `name` of the library itself, nullptr when it comes from one of its dependencies or isn't there
+void* resolve(void* handle, LoadedObject const& library, char const* name)
+{
+    auto const address = dlsym(handle, name);
+    return address != nullptr && contains(library, address) ? address : nullptr;
+}
+
+void write_trampoline(unsigned char* code, void* callee, uint32_t stack_bytes)
+{
+    auto const target = reinterpret_cast<uint64_t>(callee);
+    auto const trampoline = reinterpret_cast<uint64_t>(&shst_trampoline_sized);
+    auto at = code;
+    *at++ = 0x49; // movabs $target, %r10
+    *at++ = 0xba;
+    memcpy(at, &target, sizeof target);
+    at += sizeof target;
+    *at++ = 0x41; // mov $stack_bytes, %r11d
+    *at++ = 0xbb;
+    memcpy(at, &stack_bytes, sizeof stack_bytes);
+    at += sizeof stack_bytes;
+    *at++ = 0xff; // jmp *0(%rip)
+    *at++ = 0x25;
+    memset(at, 0, 4);
+    at += 4;
+    memcpy(at, &trampoline, sizeof trampoline);
+    at += sizeof trampoline;
+    memset(at, 0xcc, code + trampoline_size - at);
+}
+
+// for callees without one, all in a mapping of their own
+bool make_trampolines(std::vector<void*> const& callees, uint32_t stack_bytes)
+{
+    if (callees.empty()) {
+        return true;
+    }
+    auto const size = (callees.size() * trampoline_size + page_size() - 1) & ~(page_size() - 1);
+    auto const code = static_cast<unsigned char*>(
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (code == MAP_FAILED) {
+        return false;
+    }
+    for (size_t i = 0; i < callees.size(); ++i) {
+        write_trampoline(code + i * trampoline_size, callees[i], stack_bytes);
+    }
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return false;
+    }
+    for (size_t i = 0; i < callees.size(); ++i) {
+        trampolines[{callees[i], stack_bytes}] = code + i * trampoline_size;
+    }
+    return true;
+}
+
+} // namespace
+
+int attach_library(char const* library, char const* pattern, size_t stack_bytes, bool got_calls)
+{
+    if (library == nullptr || *library == '\0' || stack_bytes > UINT32_MAX) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto const objects = loaded_objects();
+    auto const target = std::find_if(objects.begin(), objects.end(), [&](LoadedObject const& object) {
+        return is_library(object.name, library);
+    });
+    if (target == objects.end()) {
+        return -1;
+    }
+    auto const handle = dlopen(target->name.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+    if (handle == nullptr) {
+        return -1;
+    }
+
+    struct Candidate
+    {
+        void** slot;
+        void* original;
+        void* callee;
+        bool read_only;
+    };
+    std::vector<Candidate> candidates;
+    // by name, nullptr for what isn't a function of the library
+    std::map<std::string, void*> callees;
+    for (auto const& object : objects) {
+        if (contains(object, reinterpret_cast<void const*>(&attach_library))) {
+            continue;
+        }
+        for_each_function_slot(object, got_calls, [&](void** slot, char const* name) {
+            if (pattern != nullptr && fnmatch(pattern, name, 0) != 0) {
+                return;
+            }
+            auto const resolved = callees.try_emplace(name, nullptr);
+            if (resolved.second) {
+                resolved.first->second = resolve(handle, *target, name);
+            }
+            auto const callee = resolved.first->second;
+            if (callee == nullptr) {
+                return;
+            }
+            auto const current = __atomic_load_n(slot, __ATOMIC_RELAXED);
+            // bound to the library, or (lazy binding) still to the object's own PLT and would be
+            if (current != callee && !(contains(object, current) && dlsym(RTLD_DEFAULT, name) == callee)) {
+                return;
+            }
+            candidates.push_back({slot, current, callee, is_read_only(object, slot)});
+        });
+    }
+    dlclose(handle);
+
+    auto const bytes = static_cast<uint32_t>(stack_bytes);
+    std::vector<void*> fresh;
+    for (auto const& candidate : candidates) {
+        if (trampolines.count({candidate.callee, bytes}) == 0 &&
+            std::find(fresh.begin(), fresh.end(), candidate.callee) == fresh.end()) {
+            fresh.push_back(candidate.callee);
+        }
+    }
+    if (!make_trampolines(fresh, bytes)) {
+        return -1;
+    }
+    auto& patches = attached[target->name];
+    int redirected = 0;
+    for (auto const& candidate : candidates) {
+        auto const trampoline = trampolines[{candidate.callee, bytes}];
+        if (write_slot(candidate.slot, trampoline, candidate.read_only)) {
+            patches.push_back({candidate.slot, candidate.original, trampoline, candidate.read_only});
+            ++redirected;
+        }
+    }
+    return redirected;
+}
+
+int detach_library(char const* library)
+{
+    if (library == nullptr) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    int restored = 0;
+    for (auto attachment = attached.begin(); attachment != attached.end();) {
+        if (!is_library(attachment->first, library)) {
+            ++attachment;
+            continue;
+        }
+        for (auto const& patch : attachment->second) {
+            // unless something else has changed it since
+            if (__atomic_load_n(patch.slot, __ATOMIC_RELAXED) == patch.trampoline &&
+                write_slot(patch.slot, patch.original, patch.read_only)) {
+                ++restored;
+            }
+        }
+        attachment = attached.erase(attachment);
+    }
+    return restored;
+}
+
+#else
+
+int attach_library(char const*, char const*, size_t, bool)
+{
+    return -1;
+}
+
+int detach_library(char const*)
+{
+    return 0;
+}
+
+#endif
+
+} // namespace shst
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+namespace shst {
+
+// Guards calls into a loaded shared library without a restart: GOT entries of the loaded objects which are bound to
+// functions of `library` (the file name, or the path it was loaded by) matching `pattern` (fnmatch(), nullptr for
+// all) get redirected to trampolines calling the function with a guard, passing `stack_bytes` of stack arguments
+// through (see shst_trampoline_sized()). Only PLT entries unless `got_calls`, see SHST_ATTACH_GOT. Returns how many
+// got redirected, -1 when the library is not loaded or there are no trampolines (x86-64 only).
+//
+// Entries redirected before are left alone, attaching again with another pattern adds to them. Objects loaded later
+// are not touched, and neither is the shadow stack library itself. Attaching a library it calls through others
+// (libc, libstdc++) ends up in recursion, though.
+int attach_library(char const* library, char const* pattern, size_t stack_bytes, bool got_calls);
+
+// Puts back what attach_library() redirected for `library`, returns how many entries. Trampolines are kept, a thread
+// may still be on its way through one.
+int detach_library(char const* library);
+
+} // namespace shst
@@ -0,0 +1,310 @@
+#include "memory-printer.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+namespace shst {
+
+// ANSI color codes for hex dump differences
+static constexpr const char* ANSI_RED_BLINK = "\033[5;41m";
+static constexpr const char* ANSI_GREEN_BLINK = "\033[5;42m";
+static constexpr const char* ANSI_RESET = "\033[0m";
+
+namespace {
+
+struct HexTable
+{
+    char digits[256][2];
+};
+
+constexpr HexTable make_hex_table()
+{
+    HexTable table{};
+    constexpr char hex[] = "0123456789abcdef";
+    for (int byte = 0; byte < 256; ++byte) {
+        table.digits[byte][0] = hex[byte >> 4];
+        table.digits[byte][1] = hex[byte & 15];
+    }
+    return table;
+}
+
+constexpr HexTable hex_table = make_hex_table();
+
+// Appends to the text of a printer, so the dumps of a whole report go out with a single write rather than a write to
+// unbuffered stderr for every few characters
+class DumpBuffer
+{
+  public:
+    explicit DumpBuffer(std::string& text)
+        : text(text)
+    {
+    }
+
+    void put(char const* part, size_t length)
+    {
+        text.append(part, length);
+    }
+
+    void put(char const* part)
+    {
+        text.append(part);
+    }
+
+    void put(char c)
+    {
+        text.push_back(c);
+    }
+
+    void put_hex(uint8_t byte)
+    {
+        put(hex_table.digits[byte], 2);
+    }
+
+    template <class... Args>
+    void put_format(char const* format, Args... args)
+    {
+        char part[64];
+        auto const length = snprintf(part, sizeof(part), format, args...);
+        put(part, std::min<size_t>(std::max(length, 0), sizeof(part) - 1));
+    }
+
+  private:
+    std::string& text;
+};
+
+} // namespace
+
+std::pair<DiffRanges::const_iterator, DiffRanges::const_iterator> MemoryPrinter::diff_between(const uint8_t* begin,
+                                                                                              const uint8_t* end) const
+{
+    auto const first = std::partition_point(diff_ranges->begin(), diff_ranges->end(), [&](DiffRange const& r) {
+        return diff_origin + r.offset + r.length <= begin;
+    });
+    auto last = first;
+    while (last != diff_ranges->end() && diff_origin + last->offset < end) {
+        ++last;
+    }
+    return {first, last};
+}
+
+void MemoryPrinter::print_header()
+{
+    if (area == DumpArea::both) {
+        caption("                      %*s      %s\n",
+                -static_cast<int>(line_lenght) * 5,
+                "ACTUAL STACK (CORRUPTED):",
+                "SHADOW STACK (CORRECT):");
+    } else if (area == DumpArea::actual) {
+        caption("                      %s\n", "ACTUAL STACK (CORRUPTED):");
+    } else {
+        caption("                      %s\n", "SHADOW STACK (CORRECT):");
+    }
+}
+
+void MemoryPrinter::caption(char const* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    va_list again;
+    va_copy(again, args);
+    auto const length = vsnprintf(nullptr, 0, format, args);
+    va_end(args);
+    if (length > 0) {
+        auto const at = text.size();
+        text.resize(at + length + 1);
+        vsnprintf(&text[at], length + 1, format, again);
+        text.resize(at + length);
+    }
+    va_end(again);
+}
+
+// whatever `out` has buffered goes first, streams without a descriptor (open_memstream()) get it through stdio
+void MemoryPrinter::flush(FILE* out)
+{
+    if (!out) {
+        out = stderr;
+    }
+    auto const fd = fileno(out);
+    if (fd < 0) {
+        fwrite(text.data(), 1, text.size(), out);
+        text.clear();
+        return;
+    }
+    fflush(out);
+    for (size_t done = 0; done < text.size();) {
+        auto const written = ::write(fd, text.data() + done, text.size() - done);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += written;
+    }
+    text.clear();
+}
+
+void MemoryPrinter::dump(const uint8_t* address,
+                         const uint8_t* shadow,
+                         size_t length,
+                         bool with_address,
+                         bool with_preview,
+                         const uint8_t* actual)
+{
+    if (!address || !length) {
+        return;
+    }
+    if (!actual) {
+        actual = address;
+    }
+    if (line_lenght == 0) {
+        line_lenght = 16;
+    }
+
+    auto align_start = reinterpret_cast<uintptr_t>(address) % line_lenght;
+    const uint8_t* print_start = address - align_start;
+    auto align_end = reinterpret_cast<uintptr_t>(address + length) % line_lenght;
+    align_end = -align_end + (align_end ? line_lenght : 0);
+    const uint8_t* print_end = address + length + align_end;
+
+    // every byte takes 3 characters in the hex part and 1 in the preview, per area, colors and marks come on top
+    auto const areas = area == DumpArea::both ? 2 : 1;
+    auto const lines = static_cast<size_t>(print_end - print_start) / line_lenght;
+    if (!hide_equal_lines) {
+        text.reserve(text.size() + lines * (line_lenght * 4 * areas + 32));
+    }
+    DumpBuffer buffer{text};
+
+    int hidden_lines = 0;
+    int hidden_bytes = 0;
+    for (auto line_start = print_start; line_start < print_end; line_start += line_lenght) {
+        auto content_start = std::max(line_start, address);
+        auto content_end = std::min(line_start + line_lenght, address + length);
+        auto content_lenght = content_end - content_start;
+        auto content_offset = content_start - address;
+        auto line_diff = diff_ranges ? diff_between(content_start, content_end)
+                                     : std::pair<DiffRanges::const_iterator, DiffRanges::const_iterator>{};
+        // with diff ranges only lines they touch get compared, those may still be equal past max_ranges
+        auto line_differs = shadow && (!diff_ranges || line_diff.first != line_diff.second)
+                                    ? memcmp(actual + content_offset, shadow + content_offset, content_lenght)
+                                    : 0;
+        auto byte_differs = [&](const uint8_t* this_byte) {
+            if (!shadow || !line_differs) {
+                return false;
+            }
+            if (diff_ranges) {
+                auto in_range = std::any_of(line_diff.first, line_diff.second, [&](DiffRange const& r) {
+                    return diff_origin + r.offset <= this_byte && this_byte < diff_origin + r.offset + r.length;
+                });
+                if (!in_range) {
+                    return false;
+                }
+            }
+            return actual[this_byte - address] != shadow[this_byte - address];
+        };
+
+        if (hide_equal_lines && !line_differs) {
+            hidden_bytes += content_lenght;
+            hidden_lines += 1;
+            continue;
+        }
+        if (hidden_bytes || hidden_lines) {
+            buffer.put_format("    (%d equal bytes in %d lines hidden)\n", hidden_bytes, hidden_lines);
+            hidden_bytes = hidden_lines = 0;
+        }
+
+        if (with_address) {
+            buffer.put_format("%c %16p |", line_differs ? '*' : ' ', static_cast<void const*>(line_start));
+        }
+
+        auto print_hex_section = [&](const uint8_t* data_source, const char* color_code, auto get_preview_char) {
+            bool prev_differs = false;
+            for (auto this_byte = line_start; this_byte < line_start + line_lenght; ++this_byte) {
+                auto in_area = this_byte >= address && this_byte < address + length;
+                if (in_area) {
+                    bool differs = byte_differs(this_byte);
+
+                    const char* prefix = " ";
+                    const char* suffix = "";
+                    const char* color_start = "";
+                    const char* color_end = "";
+                    const char* suffix_reset = "";
+
+                    if (differs && !prev_differs) {
+                        prefix = "[";
+                        color_start = use_color ? color_code : "";
+                    } else if (!differs && prev_differs) {
+                        prefix = "]";
+                        color_end = use_color ? ANSI_RESET : "";
+                    }
+
+                    bool is_last_char = (this_byte + 1 >= line_start + line_lenght) ||
+                                        (this_byte + 1 >= address + length);
+                    if (differs && is_last_char) {
+                        suffix = "]";
+                        suffix_reset = use_color ? ANSI_RESET : "";
+                    } else if (is_last_char) {
+                        suffix = " ";
+                    }
+
+                    buffer.put(color_start);
+                    buffer.put(prefix);
+                    buffer.put(color_end);
+                    buffer.put_hex(data_source[this_byte - address]);
+                    buffer.put(suffix);
+                    buffer.put(suffix_reset);
+                    prev_differs = differs;
+                } else {
+                    if (prev_differs) {
+                        buffer.put(']');
+                        buffer.put(use_color ? ANSI_RESET : "");
+                        prev_differs = false;
+                    }
+                    buffer.put("   ", 3);
+                }
+            }
+            if (with_preview) {
+                buffer.put("| ", 2);
+                for (auto this_byte = line_start; this_byte < line_start + line_lenght; ++this_byte) {
+                    auto in_area = this_byte >= address && this_byte < address + length;
+                    bool color = in_area && use_color && byte_differs(this_byte);
+                    if (color) {
+                        buffer.put(color_code);
+                    }
+                    buffer.put(static_cast<char>(in_area ? get_preview_char(this_byte - address) : ' '));
+                    if (color) {
+                        buffer.put(ANSI_RESET);
+                    }
+                }
+            }
+        };
+
+        // actual
+        if (area == DumpArea::both || area == DumpArea::actual) {
+            print_hex_section(actual, ANSI_RED_BLINK, [&](size_t offset) {
+                return isprint(actual[offset]) ? actual[offset] : '.';
+            });
+        }
+        if (area == DumpArea::both) {
+            buffer.put(" |", 2);
+        }
+        // shadow
+        if (area == DumpArea::both || area == DumpArea::shadow) {
+            print_hex_section(shadow, ANSI_GREEN_BLINK, [&](size_t offset) {
+                return isprint(shadow[offset]) ? shadow[offset] : '.';
+            });
+        }
+        buffer.put(with_preview ? " |\n" : "\n");
+    }
+    if (hidden_bytes || hidden_lines) {
+        buffer.put_format("    (%d equal bytes in %d lines hidden)\n", hidden_bytes, hidden_lines);
+        hidden_bytes = hidden_lines = 0;
+    }
+}
+
+} // namespace shst
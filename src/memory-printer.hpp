@@ -0,0 +1,68 @@
+#pragma once
+
+#include "compare.hpp"
+#include "config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+
+namespace shst {
+
+// Side by side hex dump of the actual stack and its shadow, differences marked with [] (and colors).
+struct MemoryPrinter
+{
+    MemoryPrinter(size_t line_lenght = 0,
+                  bool hide_equal_lines = false,
+                  DumpArea area = DumpArea::both,
+                  bool use_color = false)
+        : line_lenght(line_lenght)
+        , hide_equal_lines(hide_equal_lines)
+        , area(area)
+        , use_color(use_color)
+    {
+    }
+
+    size_t line_lenght = 0;
+    bool hide_equal_lines = false;
+    DumpArea area = DumpArea::both;
+    bool use_color = false;
+
+    // Differences already located by the compare kernel, `origin` is the address of offset 0. With these set only
+    // bytes within the ranges get compared, everything else is known to be equal.
+    void set_diff(DiffRanges const* ranges, uint8_t const* origin)
+    {
+        diff_ranges = ranges;
+        diff_origin = origin;
+    }
+
+    DiffRanges const* diff_ranges = nullptr;
+    uint8_t const* diff_origin = nullptr;
+
+    // ranges overlapping [begin, end)
+    std::pair<DiffRanges::const_iterator, DiffRanges::const_iterator> diff_between(const uint8_t* begin,
+                                                                                    const uint8_t* end) const;
+
+    // Header, dumps and captions pile up in `text`, flush() writes them all out at once and starts over.
+    std::string text;
+
+    void print_header();
+
+    // a line of its own between dumps, e.g. what the next one is of
+    void caption(char const* format, ...) __attribute__((format(printf, 2, 3)));
+
+    void flush(FILE* out = stderr);
+
+    // `length` bytes shown as if they were at `address`, read from `actual` (`address` itself when null) and
+    // compared with `shadow`, so a dump recorded elsewhere looks the same as one of the live stack
+    void dump(const uint8_t* address,
+              const uint8_t* shadow,
+              size_t length,
+              bool with_address = true,
+              bool with_preview = true,
+              const uint8_t* actual = nullptr);
+};
+
+} // namespace shst
@@ -0,0 +1,37 @@
+#include <stdarg.h>
+
+// Called by preload-test through the wrappers of a preload library generated from this one.
+
+typedef struct
+{
+    double x, y;
+} Vec;
+
+// 2 integer arguments on the stack
+long weighted(long a, long b, long c, long d, long e, long f, long g, long h)
+{
+    return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h;
+}
+
+Vec scale(Vec v, double s)
+{
+    Vec scaled = {v.x * s, v.y * s};
+    return scaled;
+}
+
+double average(int n, ...)
+{
+    va_list args;
+    va_start(args, n);
+    double sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += va_arg(args, double);
+    }
+    va_end(args);
+    return sum / n;
+}
+
+void overrun(int volatile* victim)
+{
+    *victim += 1;
+}
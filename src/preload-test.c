@@ -0,0 +1,66 @@
+#include "shadow-stack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Calls of a library through the preload library generated from it (see shst_add_preload_library()): results are the
+// same as without it and every call is guarded. Runs itself again with the preload library in LD_PRELOAD.
+
+typedef struct
+{
+    double x, y;
+} Vec;
+
+long weighted(long a, long b, long c, long d, long e, long f, long g, long h);
+Vec scale(Vec v, double s);
+double average(int n, ...);
+void overrun(int volatile* victim);
+
+int failures = 0;
+
+void expect(int ok, char const* what)
+{
+    printf("%-40s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+shst_stats stats(void)
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats;
+}
+
+int outer(void)
+{
+    int volatile local[4] = {0};
+
+    expect(weighted(1, 2, 3, 4, 5, 6, 7, 8) == 204, "stack arguments");
+    Vec const v = scale((Vec){1.5, -2.0}, 2.0);
+    expect(v.x == 3.0 && v.y == -4.0, "struct returned in vector registers");
+    expect(average(4, 1.0, 2.0, 3.0, 6.0) == 3.0, "variadic");
+    expect(stats().calls == 3 && stats().failed_checks == 0, "guarded, no corruption");
+
+    overrun(&local[2]);
+    expect(stats().calls == 4 && stats().failed_checks == 1, "corruption found");
+    return local[0];
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    char const* const preload = getenv("LD_PRELOAD");
+    if (preload == NULL || strstr(preload, PRELOAD_LIBRARY) == NULL) {
+        setenv("LD_PRELOAD", PRELOAD_LIBRARY, 1);
+        execv("/proc/self/exe", argv);
+        perror("preload-test: execv");
+        return 1;
+    }
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    outer();
+
+    return failures ? 1 : 0;
+}
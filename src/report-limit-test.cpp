@@ -0,0 +1,96 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// A corruption found on every call of a hot loop: with SHST_REPORT_LIMIT only the first few reports of each site are
+// made in full, the rest are counted and summarized every SHST_REPORT_SUMMARY seconds and when the thread exits.
+
+int volatile* target;
+
+int corrupt(int x)
+{
+    *target = *target + x;
+    return 0;
+}
+
+void hot_loop(int calls)
+{
+    int volatile local[64]{};
+    target = local;
+    for (int i = 0; i < calls; ++i) {
+        shst::invoke(corrupt, 1);
+    }
+    target = nullptr;
+}
+
+size_t count(std::string const& text, char const* what)
+{
+    size_t found = 0;
+    for (auto at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) {
+        ++found;
+    }
+    return found;
+}
+
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+int main()
+{
+    setenv("SHST_REACTION", "report", 1);
+    setenv("SHST_REPORT_LIMIT", "3", 1);
+    setenv("SHST_REPORT_SUMMARY", "0.2", 1);
+    shst_reload_config();
+
+    // reports go to stderr, which gets read back
+    auto const log = tmpfile();
+    fflush(stderr);
+    auto const saved_stderr = dup(STDERR_FILENO);
+    dup2(fileno(log), STDERR_FILENO);
+
+    constexpr int calls = 100000;
+    auto const start = std::chrono::steady_clock::now();
+    shst::invoke(hot_loop, calls);
+    auto const took = std::chrono::steady_clock::now() - start;
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    // the next report after SHST_REPORT_SUMMARY brings the summary
+    shst::invoke(hot_loop, 1);
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    std::thread{[] { shst::invoke(hot_loop, 1000); }}.join();
+
+    fflush(stderr);
+    dup2(saved_stderr, STDERR_FILENO);
+    std::string text(ftell(log), '\0');
+    rewind(log);
+    text.resize(fread(text.data(), 1, text.size(), log));
+
+    auto const full = count(text, "SHADOW STACK REPORT\n");
+    auto const summaries = count(text, "SHADOW STACK REPORT SUMMARY\n");
+    printf("%d looping calls took %.1f ms, %zu full reports, %zu summaries, %llu reports suppressed\n",
+           calls,
+           std::chrono::duration<double, std::milli>(took).count(),
+           full,
+           summaries,
+           stats.suppressed_reports);
+    // a handful of sites: the loop's first call sees other bytes differ than the rest, and the thread has its own
+    expect(full > 0 && full <= 3 * 6, "first 3 reports of each site in full");
+    expect(stats.suppressed_reports >= calls - full, "the rest suppressed");
+    expect(summaries == 2, "summarized periodically and at thread exit");
+    expect(text.find("Reports over SHST_REPORT_LIMIT") != std::string::npos &&
+                   text.find("= " + std::string{"<unknown_callee>"}) == std::string::npos,
+           "summary names the sites");
+
+    return failures ? 1 : 0;
+}
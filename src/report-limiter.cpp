@@ -0,0 +1,91 @@
+#include "report-limiter.hpp"
+
+namespace shst {
+
+namespace {
+
+constexpr size_t initial_capacity = 64;
+
+size_t bucket(uint64_t key, size_t capacity)
+{
+    return (key >> 32 ^ key) & (capacity - 1);
+}
+
+} // namespace
+
+bool ReportLimiter::admit(Site const& site, uint64_t limit)
+{
+    if (limit == 0) {
+        return true;
+    }
+    // 0 marks free entries
+    auto& counted = entry(site.key ? site : Site{1, site.callee, site.position});
+    if (++counted.total <= limit) {
+        return true;
+    }
+    if (counted.suppressed++ == 0) {
+        ++with_pending;
+    }
+    return false;
+}
+
+std::vector<ReportLimiter::Pending> ReportLimiter::take_pending(uint64_t now_ns, uint64_t interval_ns)
+{
+    std::vector<Pending> pending;
+    if (interval_ns && (last_summary == 0 || now_ns - last_summary < interval_ns)) {
+        if (last_summary == 0) {
+            last_summary = now_ns;
+        }
+        return pending;
+    }
+    if (with_pending == 0) {
+        return pending;
+    }
+    for (auto& counted : entries) {
+        if (counted.suppressed) {
+            pending.push_back({counted.site, counted.suppressed, counted.total});
+            counted.suppressed = 0;
+        }
+    }
+    with_pending = 0;
+    last_summary = now_ns;
+    return pending;
+}
+
+ReportLimiter::Entry& ReportLimiter::entry(Site const& site)
+{
+    if (entries.empty() || (used + 1) * 2 > entries.size()) {
+        grow();
+    }
+    auto const mask = entries.size() - 1;
+    for (auto i = bucket(site.key, entries.size());; i = (i + 1) & mask) {
+        auto& counted = entries[i];
+        if (counted.site.key == site.key) {
+            return counted;
+        }
+        if (counted.site.key == 0) {
+            counted.site = site;
+            ++used;
+            return counted;
+        }
+    }
+}
+
+void ReportLimiter::grow()
+{
+    std::vector<Entry> old(entries.empty() ? initial_capacity : entries.size() * 2);
+    old.swap(entries);
+    auto const mask = entries.size() - 1;
+    for (auto const& counted : old) {
+        if (counted.site.key == 0) {
+            continue;
+        }
+        auto i = bucket(counted.site.key, entries.size());
+        while (entries[i].site.key) {
+            i = (i + 1) & mask;
+        }
+        entries[i] = counted;
+    }
+}
+
+} // namespace shst
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace shst {
+
+// Keeps a corruption which fires over and over (say in a hot loop, with SHST_REACTION=report or heal) from flooding
+// the output and slowing the process down to a crawl.
+//
+// Reports are told apart by site: callee and position of the frame being checked, and a signature of where the
+// differences are. The first `limit` reports of every site are made in full, further ones are only counted; sites
+// with counted reports show up in a summary every now and then, and once more when the thread exits. The table is
+// per thread, no locks and no atomics on the way.
+class ReportLimiter
+{
+  public:
+    struct Site
+    {
+        uint64_t key;
+        void const* callee;
+        size_t position;
+    };
+
+    struct Pending
+    {
+        Site site;
+        // since the last summary
+        uint64_t suppressed;
+        uint64_t total;
+    };
+
+    // builds up the key of a site, feed it whatever tells sites apart
+    static uint64_t mix(uint64_t key, uint64_t value) noexcept
+    {
+        return (key ^ value) * UINT64_C(0x9e3779b97f4a7c15) + (key >> 29);
+    }
+
+    // counts a report at the site, true when it is to be made in full; 0 means no limit
+    [[nodiscard]] bool admit(Site const& site, uint64_t limit);
+
+    // sites with reports suppressed since the last summary, or an empty list until `interval_ns` passes since then
+    // (the first call only starts the clock), 0 takes them right away
+    [[nodiscard]] std::vector<Pending> take_pending(uint64_t now_ns, uint64_t interval_ns);
+
+  private:
+    struct Entry
+    {
+        Site site;
+        uint64_t total;
+        uint64_t suppressed;
+    };
+
+    [[nodiscard]] Entry& entry(Site const& site);
+    void grow();
+
+    size_t used{};
+    size_t with_pending{};
+    // 0 until the first take_pending()
+    uint64_t last_summary{};
+    // open addressing with linear probing, size is a power of two, key 0 marks a free entry
+    std::vector<Entry> entries;
+};
+
+} // namespace shst
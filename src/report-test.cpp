@@ -0,0 +1,161 @@
+#include "report.hpp"
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include "symbolizer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Reports queued for SHST_REPORT_FILE (read at load time, so the test re-executes itself with it set): the call which
+// found the corruption goes on right away, the record shows up in the file with names resolved, renders into the
+// usual text, and a forked child writes a file of its own. With SHST_SYMBOLIZE=offline the record carries the loaded
+// objects instead, with build-ids, and gets named from the files.
+
+int volatile* target;
+
+int corrupt(int x)
+{
+    *target += x;
+    return 0;
+}
+
+int caller()
+{
+    int volatile local[64]{};
+    target = local;
+    return shst::invoke(corrupt, 1) + local[0];
+}
+
+std::vector<uint8_t> read_file(std::string const& path)
+{
+    std::ifstream file{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file}, {}};
+}
+
+// records of the file, once there are `count` of them
+std::vector<shst::Report> wait_for(std::string const& path, size_t count, std::vector<uint8_t>& content)
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    for (;;) {
+        content = read_file(path);
+        std::vector<shst::Report> reports;
+        for (size_t offset = 16; offset < content.size();) {
+            shst::Report report;
+            if (!decode(content.data() + offset, content.size() - offset, report)) {
+                break;
+            }
+            offset += report.header->size;
+            reports.push_back(std::move(report));
+        }
+        if (reports.size() >= count || std::chrono::steady_clock::now() > deadline) {
+            return reports;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+int main(int, char** argv)
+{
+    if (getenv("SHST_REPORT_FILE") == nullptr) {
+        auto const path = "/tmp/shst-report-test-" + std::to_string(getpid());
+        setenv("SHST_REPORT_FILE", path.c_str(), 1);
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        return 1;
+    }
+    std::string const path = getenv("SHST_REPORT_FILE");
+    setenv("SHST_REACTION", "report", 1);
+    shst_reload_config();
+
+    // the first report loads libgcc_s for backtrace() and resolves symbols, it is not measured
+    shst::invoke(caller);
+    auto const start = std::chrono::steady_clock::now();
+    shst::invoke(caller);
+    auto const took = std::chrono::steady_clock::now() - start;
+    printf("reporting call took %.1f us\n", std::chrono::duration<double, std::micro>(took).count());
+
+    std::vector<uint8_t> content;
+    auto const reports = wait_for(path, 2, content);
+    expect(reports.size() == 2, "records written");
+    if (reports.size() == 2) {
+        auto const& report = reports.back();
+        auto const& header = *report.header;
+        expect(header.kind == shst::ReportKind::check && header.direction == shst::ReportDirection::post_return &&
+                       header.frames >= 2 && header.shown >= 2 && header.backtrace > 0,
+               "record contents");
+        auto const callee = report.names.find(report.frames[0].callee);
+        expect(callee != report.names.end() && callee->second.find("corrupt") != std::string::npos,
+               "callee named by the writer");
+
+        char* text = nullptr;
+        size_t length = 0;
+        auto const out = open_memstream(&text, &length);
+        render(report, shst::render_options(header, -1), out);
+        fclose(out);
+        expect(strstr(text, "During POST-RETURN from:") && strstr(text, "above is frame of:") &&
+                       strstr(text, "\nbacktrace:\n"),
+               "rendered");
+        free(text);
+
+        // lengths from a damaged file which wrap around once multiplied or padded
+        auto const record = reinterpret_cast<uint8_t const*>(report.header);
+        std::vector<uint8_t> damaged(record, record + header.size);
+        shst::Report ignored;
+        reinterpret_cast<uint64_t*>(damaged.data() + report.unnamed_size)[1] = ~uint64_t{0} - 3;
+        auto const bad_name = !decode(damaged.data(), damaged.size(), ignored);
+        damaged.assign(record, record + header.size);
+        auto const frame = reinterpret_cast<uint8_t const*>(&report.frames[report.shown[0]].size) - record;
+        *reinterpret_cast<uint64_t*>(damaged.data() + frame) = ~uint64_t{0} / 2 + 1;
+        expect(bad_name && !decode(damaged.data(), damaged.size(), ignored), "damaged lengths refused");
+    }
+
+    setenv("SHST_SYMBOLIZE", "offline", 1);
+    shst_reload_config();
+    shst::invoke(caller);
+    auto const offline = wait_for(path, 3, content);
+    expect(offline.size() == 3, "offline record written");
+    if (offline.size() == 3) {
+        auto const& report = offline.back();
+        auto const callee = report.frames[0].callee;
+        auto const object = std::find_if(report.modules.begin(), report.modules.end(), [&](auto const& module) {
+            return callee >= module.begin && callee < module.end;
+        });
+        expect((report.header->flags & shst::report_offline) && report.names.empty() &&
+                       object != report.modules.end() && !object->build_id.empty(),
+               "loaded objects instead of names");
+        shst::OfflineSymbolizer symbolizer{{}};
+        expect(symbolizer.name(report.modules, callee).find("corrupt") != std::string::npos, "named offline");
+    }
+
+    fflush(stdout);
+    auto const child = fork();
+    if (child == 0) {
+        shst::invoke(caller);
+        exit(0);
+    }
+    waitpid(child, nullptr, 0);
+    auto const child_path = path + "." + std::to_string(child);
+    expect(wait_for(child_path, 1, content).size() == 1, "forked child writes its own file");
+    expect(wait_for(path, 3, content).size() == 3, "parent file left alone");
+
+    unlink(path.c_str());
+    unlink(child_path.c_str());
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+#include "report-writer.hpp"
+#include "report.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Records of mixed sizes through a ring a few records large, so it wraps over and over and slots start in the middle
+// of what older records left behind (ranges of 1s, which read as committed slots), committed out of order while the
+// writer is at them: every record ends up in the file, in order and intact.
+
+// `ranges` ranges, all of them {1, index}
+std::vector<uint8_t> make_record(uint64_t index, uint32_t ranges)
+{
+    shst::ReportHeader header{};
+    header.magic = shst::report_magic;
+    header.kind = shst::ReportKind::check;
+    header.ranges = ranges;
+    header.thread = index;
+    std::vector<shst::DiffRange> const diffs(ranges, shst::DiffRange{1, index});
+    shst::ReportEncoder counter;
+    counter.put(&header, 1);
+    counter.put(diffs.data(), diffs.size());
+    header.size = counter.size();
+    std::vector<uint8_t> record(header.size);
+    shst::ReportEncoder encoder{record.data()};
+    encoder.put(&header, 1);
+    encoder.put(diffs.data(), diffs.size());
+    return record;
+}
+
+int failures = 0;
+
+void expect(bool ok, char const* what)
+{
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+int main()
+{
+    auto const path = "/tmp/shst-report-writer-test-" + std::to_string(getpid());
+    constexpr size_t capacity = 4096;
+    constexpr uint64_t count = 400;
+    auto const writer = new shst::ReportWriter{path, capacity};
+
+    size_t written = 0;
+    uint64_t index = 0;
+    while (index < count) {
+        // a few in flight, the first committed right away and the writer given time to get to the next ones
+        std::vector<shst::ReportWriter::Ticket> tickets;
+        for (int i = 0; i < 3 && index < count; ++i, ++index) {
+            auto const record = make_record(index, 1 + index * 7 % 40);
+            auto const ticket = writer->reserve(record.size());
+            if (ticket.record == nullptr) {
+                break;
+            }
+            std::copy(record.begin(), record.end(), ticket.record);
+            tickets.push_back(ticket);
+            written += record.size();
+        }
+        for (auto const& ticket : tickets) {
+            writer->commit(ticket);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        if (!tickets.empty()) {
+            writer->flush(tickets.back());
+        }
+    }
+    writer->finish();
+    expect(written > 20 * capacity, "ring wrapped many times");
+
+    std::ifstream file{path, std::ios::binary};
+    std::vector<uint8_t> const content{std::istreambuf_iterator<char>{file}, {}};
+    uint64_t decoded = 0;
+    bool intact = true;
+    for (size_t offset = 16; offset < content.size();) {
+        shst::Report report;
+        if (!decode(content.data() + offset, content.size() - offset, report)) {
+            intact = false;
+            break;
+        }
+        auto const& header = *report.header;
+        intact = intact && header.thread == decoded && header.ranges == 1 + decoded * 7 % 40;
+        for (size_t i = 0; i < header.ranges; ++i) {
+            intact = intact && report.ranges[i].offset == 1 && report.ranges[i].length == decoded;
+        }
+        offset += header.size;
+        ++decoded;
+    }
+    expect(decoded == count, "every record written");
+    expect(intact, "records decode, in order and intact");
+
+    unlink(path.c_str());
+    return failures ? 1 : 0;
+}
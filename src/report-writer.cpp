@@ -0,0 +1,242 @@
+#include "report-writer.hpp"
+#include "report.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+namespace shst {
+
+namespace {
+
+constexpr size_t default_capacity = 8 << 20;
+constexpr size_t file_growth = 1 << 20;
+
+// "%p" is replaced with the process id
+std::string expand(std::string path, bool child)
+{
+    auto const pid = std::to_string(getpid());
+    auto const at = path.find("%p");
+    if (at != std::string::npos) {
+        path.replace(at, 2, pid);
+    } else if (child) {
+        // never overwrite the reports of the parent
+        path += '.' + pid;
+    }
+    return path;
+}
+
+ReportWriter* writer;
+
+// configured at load time, like SHST_RELOAD_SIGNAL
+[[maybe_unused]] bool const started = [] {
+    auto const path = getenv("SHST_REPORT_FILE");
+    if (path == nullptr || *path == '\0') {
+        return false;
+    }
+    auto const buffer = getenv("SHST_REPORT_BUFFER");
+    auto const capacity = buffer ? strtoull(buffer, nullptr, 0) : default_capacity;
+    writer = new ReportWriter{path, std::max<size_t>(capacity, 4096) & ~size_t{7}};
+    atexit([] { writer->finish(); });
+    return true;
+}();
+
+} // namespace
+
+ReportWriter* ReportWriter::instance()
+{
+    return writer;
+}
+
+ReportWriter::ReportWriter(std::string path, size_t capacity)
+    : path{std::move(path)}
+    , ring{static_cast<uint8_t*>(
+              mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0))}
+    , capacity{capacity}
+{
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "shadow stack: can't allocate report buffer (%s), reports dropped\n", strerror(errno));
+        ring = nullptr;
+        return;
+    }
+    sem_init(&wakeup, 0, 0);
+    pthread_atfork(nullptr, nullptr, on_fork);
+    start();
+}
+
+void ReportWriter::on_fork()
+{
+    writer->forked.store(true, std::memory_order_relaxed);
+}
+
+void ReportWriter::restart()
+{
+    // the only thread of a fresh child, whatever the parent had in flight is not ours to write
+    if (file) {
+        munmap(file, file_capacity);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    memset(ring, 0, capacity);
+    sem_init(&wakeup, 0, 0);
+    child = true;
+    start();
+}
+
+void ReportWriter::start()
+{
+    if (!open_file()) {
+        return;
+    }
+    pthread_t thread;
+    if (auto const error = pthread_create(&thread, nullptr, run, this)) {
+        fprintf(stderr, "shadow stack: can't start report writer (%s)\n", strerror(error));
+        return;
+    }
+    pthread_detach(thread);
+}
+
+bool ReportWriter::open_file()
+{
+    auto const name = expand(path, child);
+    fd = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "shadow stack: can't open %s (%s), reports dropped\n", name.c_str(), strerror(errno));
+        return false;
+    }
+    file = nullptr;
+    file_capacity = file_size = 0;
+    uint32_t const version[2]{1, 1};
+    append(reinterpret_cast<uint8_t const*>(report_file_magic), sizeof(report_file_magic));
+    append(reinterpret_cast<uint8_t const*>(version), sizeof(version));
+    return true;
+}
+
+ReportWriter::Slot& ReportWriter::slot(uint64_t position)
+{
+    return *reinterpret_cast<Slot*>(ring + position % capacity);
+}
+
+ReportWriter::Ticket ReportWriter::reserve(size_t size)
+{
+    if (forked.exchange(false, std::memory_order_relaxed)) {
+        restart();
+    }
+    auto const length = sizeof(Slot) + ((size + 7) & ~size_t{7});
+    auto position = head.load(std::memory_order_relaxed);
+    for (;;) {
+        auto const offset = position % capacity;
+        // records never wrap, the rest of the ring gets skipped instead
+        auto const padding = offset + length > capacity ? capacity - offset : 0;
+        if (!ring || position + padding + length - tail.load(std::memory_order_acquire) > capacity) {
+            if (dropped.fetch_add(1, std::memory_order_relaxed) == 0) {
+                fprintf(stderr, "shadow stack: report dropped, no room for it (see SHST_REPORT_BUFFER)\n");
+            }
+            return {nullptr, 0};
+        }
+        if (head.compare_exchange_weak(position, position + padding + length, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    auto const offset = position % capacity;
+    if (offset + length > capacity) {
+        auto& skipped = slot(position);
+        skipped.length = capacity - offset;
+        skipped.state.store(slot_padding, std::memory_order_release);
+        position += capacity - offset;
+    }
+    auto& reserved = slot(position);
+    reserved.length = length;
+    return {reinterpret_cast<uint8_t*>(&reserved + 1), position + length};
+}
+
+void ReportWriter::commit(Ticket const& ticket)
+{
+    auto& committed = *(reinterpret_cast<Slot*>(ticket.record) - 1);
+    committed.state.store(slot_committed, std::memory_order_release);
+    sem_post(&wakeup);
+}
+
+void ReportWriter::flush(Ticket const& ticket)
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (tail.load(std::memory_order_acquire) < ticket.end && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void ReportWriter::finish()
+{
+    if (ring) {
+        flush({nullptr, head.load(std::memory_order_acquire)});
+    }
+}
+
+void* ReportWriter::run(void* self)
+{
+    static_cast<ReportWriter*>(self)->drain();
+    return nullptr;
+}
+
+void ReportWriter::drain()
+{
+    for (;;) {
+        auto const position = tail.load(std::memory_order_relaxed);
+        auto& next = slot(position);
+        auto const state = position == head.load(std::memory_order_acquire)
+                                   ? slot_free
+                                   : next.state.load(std::memory_order_acquire);
+        if (state == slot_free) {
+            // nothing there or not committed yet
+            while (sem_wait(&wakeup) != 0 && errno == EINTR) {
+            }
+            continue;
+        }
+        auto const length = next.length;
+        if (state == slot_committed) {
+            auto const named = complete(reinterpret_cast<uint8_t const*>(&next + 1), length - sizeof(Slot));
+            append(named.data(), named.size());
+        }
+        // all of it, a slot reserved later may start anywhere in there and has to read as free until committed
+        memset(ring + position % capacity, 0, length);
+        tail.store(position + length, std::memory_order_release);
+    }
+}
+
+// The file is never longer than what got appended, whenever the process dies, only the mapping reaches further (to
+// be grown less often).
+void ReportWriter::append(uint8_t const* record, size_t size)
+{
+    if (fd < 0 || ftruncate(fd, file_size + size) != 0) {
+        return;
+    }
+    if (file_size + size > file_capacity) {
+        auto const grown =
+                std::max(file_capacity * 2, (file_size + size + file_growth - 1) / file_growth * file_growth);
+        if (file) {
+            munmap(file, file_capacity);
+        }
+        auto const mapped = mmap(nullptr, grown, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            file = nullptr;
+            file_capacity = 0;
+            return;
+        }
+        file = static_cast<uint8_t*>(mapped);
+        file_capacity = grown;
+    }
+    memcpy(file + file_size, record, size);
+    file_size += size;
+}
+
+} // namespace shst
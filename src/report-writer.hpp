@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <semaphore.h>
+#include <string>
+
+namespace shst {
+
+// With SHST_REPORT_FILE set reports are not printed, but queued as binary records (see report.hpp) and written to
+// that file by a background thread, so the thread which found the corruption goes on right away. shst-report turns
+// the file into text.
+//
+// Records go into a ring preallocated at load time (SHST_REPORT_BUFFER bytes). Any thread reserves room for a record
+// with a CAS, fills it in and commits it. The writer clears what it has taken, room is reserved in cleared memory
+// only, so a slot reads as free until committed. The writer takes committed records in order,
+// adds symbol names (or the loaded objects, see SHST_SYMBOLIZE) and appends them to the file, which is mapped into
+// memory and grown as needed. Records which don't fit into the ring are dropped.
+class ReportWriter
+{
+  public:
+    // null unless SHST_REPORT_FILE is set
+    static ReportWriter* instance();
+
+    struct Ticket
+    {
+        // where to build the record, null when there is no room for it
+        uint8_t* record;
+        // position in the ring right behind the record
+        uint64_t end;
+    };
+
+    [[nodiscard]] Ticket reserve(size_t size);
+    void commit(Ticket const& ticket);
+    // waits (a while) until the record is in the file, before abort() e.g.
+    void flush(Ticket const& ticket);
+    // waits for everything committed so far to get written
+    void finish();
+
+    ReportWriter(std::string path, size_t capacity);
+    ReportWriter(ReportWriter const&) = delete;
+    ReportWriter& operator=(ReportWriter const&) = delete;
+
+  private:
+    struct Slot
+    {
+        std::atomic<uint32_t> state;
+        // including the slot itself
+        uint32_t length;
+    };
+
+    static constexpr uint32_t slot_free = 0;
+    static constexpr uint32_t slot_committed = 1;
+    static constexpr uint32_t slot_padding = 2;
+
+    [[nodiscard]] Slot& slot(uint64_t position);
+    void start();
+    void restart();
+    static void* run(void* self);
+    void drain();
+    void append(uint8_t const* record, size_t size);
+    [[nodiscard]] bool open_file();
+
+    std::string const path;
+    uint8_t* ring;
+    size_t const capacity;
+    // positions only grow, the offset in the ring is position % capacity
+    std::atomic<uint64_t> head{};
+    std::atomic<uint64_t> tail{};
+    std::atomic<uint64_t> dropped{};
+    sem_t wakeup;
+
+    // writer thread only
+    int fd = -1;
+    uint8_t* file = nullptr;
+    size_t file_capacity = 0;
+    size_t file_size = 0;
+
+    // a forked child starts over with a file of its own on its first report
+    std::atomic<bool> forked{};
+    bool child = false;
+    static void on_fork();
+};
+
+} // namespace shst
@@ -0,0 +1,392 @@
+#include "report.hpp"
+#include "memory-printer.hpp"
+#include "symbolizer.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+namespace shst {
+
+namespace {
+
+constexpr size_t padded(size_t length)
+{
+    return (length + 7) & ~size_t{7};
+}
+
+// walks the arrays of a record, refusing to go past its end
+class Reader
+{
+  public:
+    Reader(uint8_t const* record, size_t size)
+        : next{record}
+        , end{record + size}
+    {
+    }
+
+    // `count` comes from the record, checked before it gets multiplied or padded so that it cannot wrap around
+    template <class T>
+    [[nodiscard]] bool get(T const*& items, uint64_t count)
+    {
+        auto const left = static_cast<size_t>(end - next);
+        if (count > left / sizeof(T) || left < padded(sizeof(T) * count)) {
+            return false;
+        }
+        items = reinterpret_cast<T const*>(next);
+        next += padded(sizeof(T) * count);
+        return true;
+    }
+
+    [[nodiscard]] uint8_t const* position() const noexcept
+    {
+        return next;
+    }
+
+  private:
+    uint8_t const* next;
+    uint8_t const* const end;
+};
+
+void* pointer(uint64_t address)
+{
+    return reinterpret_cast<void*>(static_cast<uintptr_t>(address));
+}
+
+} // namespace
+
+void ReportEncoder::put_bytes(void const* bytes, size_t length)
+{
+    if (out) {
+        memcpy(out + written, bytes, length);
+        memset(out + written + length, 0, padded(length) - length);
+    }
+    written += padded(length);
+}
+
+bool decode(uint8_t const* record, size_t size, Report& report)
+{
+    report = Report{};
+    report.header = reinterpret_cast<ReportHeader const*>(record);
+    auto const& header = *report.header;
+    if (size < sizeof(header) || header.magic != report_magic || header.size > size || header.size % 8) {
+        return false;
+    }
+    Reader reader{record, header.size};
+    if (!reader.get(report.header, 1) || !reader.get(report.frames, header.frames)) {
+        return false;
+    }
+    if (header.kind == ReportKind::watch_hit && (header.frames != 1 || !reader.get(report.watch, 1))) {
+        return false;
+    }
+    if (header.kind == ReportKind::summary && !reader.get(report.suppressed, header.frames)) {
+        return false;
+    }
+    if (!reader.get(report.corrupted, header.corrupted) || !reader.get(report.words, header.words) ||
+        !reader.get(report.ranges, header.ranges) || !reader.get(report.shown, header.shown)) {
+        return false;
+    }
+    for (size_t i = 0; i < header.corrupted; ++i) {
+        if (report.corrupted[i] >= header.frames) {
+            return false;
+        }
+    }
+    report.bytes = reader.position();
+    size_t offset = 0;
+    auto const copies = header.flags & report_with_shadow ? 2 : 1;
+    for (size_t i = 0; i < header.shown; ++i) {
+        if (report.shown[i] >= header.frames) {
+            return false;
+        }
+        report.shown_offsets.push_back(offset);
+        uint8_t const* bytes;
+        for (int copy = 0; copy < copies; ++copy) {
+            if (!reader.get(bytes, report.frames[report.shown[i]].size)) {
+                return false;
+            }
+        }
+        offset = reader.position() - report.bytes;
+    }
+    if (!reader.get(report.backtrace, header.backtrace)) {
+        return false;
+    }
+    for (size_t i = 0; i < header.modules; ++i) {
+        ReportModule const* module = nullptr;
+        char const* path = nullptr;
+        char const* build_id = nullptr;
+        if (!reader.get(module, 1) || !reader.get(path, module->path_length) ||
+            !reader.get(build_id, module->build_id_length)) {
+            return false;
+        }
+        report.modules.push_back({static_cast<uintptr_t>(module->bias),
+                                  static_cast<uintptr_t>(module->begin),
+                                  static_cast<uintptr_t>(module->end),
+                                  std::string(path, module->path_length),
+                                  std::string(build_id, module->build_id_length)});
+    }
+    report.unnamed_size = reader.position() - record;
+    for (size_t i = 0; i < header.names; ++i) {
+        uint64_t const* entry;
+        char const* name;
+        if (!reader.get(entry, 2) || !reader.get(name, entry[1])) {
+            return false;
+        }
+        report.names.emplace(entry[0], std::string(name, entry[1]));
+    }
+    return true;
+}
+
+std::vector<uint8_t> add_names(uint8_t const* record, size_t size, Namer const& namer)
+{
+    Report report;
+    if (!decode(record, size, report)) {
+        return {};
+    }
+    auto const& header = *report.header;
+    std::vector<uint64_t> addresses;
+    for (size_t i = 0; i < header.frames; ++i) {
+        addresses.push_back(report.frames[i].callee);
+    }
+    if (report.watch) {
+        addresses.push_back(report.watch->next_instruction);
+    }
+    for (size_t i = 0; i < header.words; ++i) {
+        addresses.push_back(report.words[i].callee);
+    }
+
+    std::unordered_map<uint64_t, std::string> names;
+    for (auto address : addresses) {
+        if (names.find(address) == names.end()) {
+            names.emplace(address, namer(address, false));
+        }
+    }
+    // return addresses, never the entry of a function like callees are, printed the way backtrace_symbols_fd() did
+    for (size_t i = 0; i < header.backtrace; ++i) {
+        names.emplace(report.backtrace[i], namer(report.backtrace[i], true));
+    }
+
+    ReportEncoder counter;
+    for (auto const& [address, name] : names) {
+        uint64_t const entry[]{address, name.size()};
+        counter.put(entry, 2);
+        counter.put_bytes(name.data(), name.size());
+    }
+    std::vector<uint8_t> named(report.unnamed_size + counter.size());
+    memcpy(named.data(), record, report.unnamed_size);
+    ReportEncoder encoder{named.data() + report.unnamed_size};
+    for (auto const& [address, name] : names) {
+        uint64_t const entry[]{address, name.size()};
+        encoder.put(entry, 2);
+        encoder.put_bytes(name.data(), name.size());
+    }
+    auto& named_header = *reinterpret_cast<ReportHeader*>(named.data());
+    named_header.size = named.size();
+    named_header.names = names.size();
+    return named;
+}
+
+std::vector<uint8_t> add_names(uint8_t const* record, size_t size)
+{
+    return add_names(record, size, [](uint64_t address, bool line) {
+        return Symbolizer::instance().name(pointer(address), line);
+    });
+}
+
+std::vector<uint8_t> add_modules(uint8_t const* record, size_t size)
+{
+    Report report;
+    if (!decode(record, size, report)) {
+        return {};
+    }
+    auto objects = loaded_objects();
+    for (auto& object : objects) {
+        if (object.file.empty()) {
+            // the main program, dl_iterate_phdr() has no name for it
+            char path[4096];
+            auto const length = readlink("/proc/self/exe", path, sizeof(path));
+            object.file.assign(path, length > 0 ? length : 0);
+        }
+    }
+    auto encode = [&](ReportEncoder& encoder) {
+        for (auto const& object : objects) {
+            ReportModule const module{object.bias,
+                                      object.begin,
+                                      object.end,
+                                      static_cast<uint32_t>(object.file.size()),
+                                      static_cast<uint32_t>(object.build_id.size())};
+            encoder.put(&module, 1);
+            encoder.put_bytes(object.file.data(), object.file.size());
+            encoder.put_bytes(object.build_id.data(), object.build_id.size());
+        }
+    };
+    // names (there should be none) go, modules already there are replaced
+    auto const kept = reinterpret_cast<uint8_t const*>(report.backtrace + report.header->backtrace) - record;
+    ReportEncoder counter;
+    encode(counter);
+    std::vector<uint8_t> extended(kept + counter.size());
+    memcpy(extended.data(), record, kept);
+    ReportEncoder encoder{extended.data() + kept};
+    encode(encoder);
+    auto& header = *reinterpret_cast<ReportHeader*>(extended.data());
+    header.size = extended.size();
+    header.modules = objects.size();
+    header.names = 0;
+    return extended;
+}
+
+std::vector<uint8_t> complete(uint8_t const* record, size_t size)
+{
+    auto const& header = *reinterpret_cast<ReportHeader const*>(record);
+    if (size >= sizeof(header) && (header.flags & report_offline)) {
+        return add_modules(record, size);
+    }
+    return add_names(record, size);
+}
+
+std::string name_of(Report const& report, uint64_t address, bool line)
+{
+    auto const found = report.names.find(address);
+    if (found != report.names.end()) {
+        return found->second;
+    }
+    for (auto const& module : report.modules) {
+        if (address >= module.begin && address < module.end) {
+            return describe(module.file.c_str(), nullptr, module.bias, address, line);
+        }
+    }
+    return report.modules.empty() ? "<unknown_callee>" : describe(nullptr, nullptr, 0, address, line);
+}
+
+RenderOptions render_options(ReportHeader const& header, int tty)
+{
+    RenderOptions options{header.dump_width, header.dump_area, header.dump_hide_equal != 0, false};
+    switch (header.dump_color) {
+        case DumpColor::always:
+            options.color = true;
+            break;
+        case DumpColor::never:
+            options.color = false;
+            break;
+        default:
+            options.color = isatty(tty);
+            break;
+    }
+    return options;
+}
+
+void render(Report const& report, RenderOptions const& options, FILE* out)
+{
+    auto const& header = *report.header;
+    auto name = [&](uint64_t address, bool line = false) { return name_of(report, address, line); };
+    auto print_frame = [&](ReportFrame const& frame) {
+        fprintf(out,
+                "  position %10zd, size %10zd, callee %16p = %s\n",
+                static_cast<size_t>(frame.position),
+                static_cast<size_t>(frame.size),
+                pointer(frame.callee),
+                name(frame.callee).c_str());
+    };
+    auto print_backtrace = [&] {
+        fprintf(out, "\nbacktrace:\n");
+        if (header.backtrace == 0) {
+            fprintf(out, "backtrace() failed\n");
+        }
+        for (size_t i = 0; i < header.backtrace; ++i) {
+            fprintf(out, "%s\n", name(report.backtrace[i], true).c_str());
+        }
+    };
+
+    fprintf(out, header.kind == ReportKind::summary ? "SHADOW STACK REPORT SUMMARY\n" : "SHADOW STACK REPORT\n");
+
+    if (header.kind == ReportKind::watch_hit) {
+        fprintf(out, "\nDuring WRITE to watched return address of:\n");
+        print_frame(report.frames[0]);
+        fprintf(out,
+                "  return address %16p at %16p overwritten with %16p\n",
+                pointer(report.watch->return_address),
+                pointer(report.watch->slot),
+                pointer(report.watch->corrupted));
+        fprintf(out,
+                "  by instruction right before %16p = %s\n",
+                pointer(report.watch->next_instruction),
+                name(report.watch->next_instruction).c_str());
+        print_backtrace();
+        return;
+    }
+
+    if (header.kind == ReportKind::summary) {
+        fprintf(out, "\nReports over SHST_REPORT_LIMIT, not made in full since the last summary:\n");
+        for (size_t i = 0; i < header.frames; ++i) {
+            auto const& frame = report.frames[i];
+            fprintf(out,
+                    "  suppressed %10llu, total %10llu, position %10zd, callee %16p = %s\n",
+                    static_cast<unsigned long long>(report.suppressed[i].suppressed),
+                    static_cast<unsigned long long>(report.suppressed[i].total),
+                    static_cast<size_t>(frame.position),
+                    pointer(frame.callee),
+                    name(frame.callee).c_str());
+        }
+        return;
+    }
+
+    auto const during = header.direction == ReportDirection::pre_call      ? "PRE-CALL to"
+                        : header.direction == ReportDirection::post_return ? "POST-RETURN from"
+                                                                           : "SUSPENSION of";
+    fprintf(out, "\nDuring %s:\n", during);
+    for (size_t i = 0; i < header.frames; ++i) {
+        print_frame(report.frames[i]);
+        if (i == 0) {
+            fprintf(out, "NEXT SHADOW FRAMES (recent first):\n");
+        }
+    }
+
+    if (header.check_mode == CheckMode::fingerprint) {
+        fprintf(out, "\nFINGERPRINT MISMATCH IN FRAMES:\n");
+        for (size_t i = 0; i < header.corrupted; ++i) {
+            print_frame(report.frames[report.corrupted[i]]);
+        }
+        if (!(header.flags & report_keep_copy)) {
+            fprintf(out, "(no shadow copy kept, see SHST_FINGERPRINT_COPY)\n");
+        }
+    }
+
+    if (header.check_mode == CheckMode::return_address) {
+        fprintf(out, "\nFRAME RECORD MISMATCH AT:\n");
+        for (size_t i = 0; i < header.words; ++i) {
+            auto const& word = report.words[i];
+            fprintf(out,
+                    "  position %10zd, %-19s %16p, expected %16p, in frame of %16p = %s\n",
+                    static_cast<size_t>(word.position),
+                    word.return_address ? "return address" : "saved frame pointer",
+                    pointer(word.actual),
+                    pointer(word.expected),
+                    pointer(word.callee),
+                    name(word.callee).c_str());
+        }
+    }
+
+    auto const with_shadow = (header.flags & report_with_shadow) != 0;
+    DiffRanges const ranges(report.ranges, report.ranges + header.ranges);
+    auto const stack = static_cast<uint8_t const*>(pointer(header.stack));
+
+    fprintf(out, "\n");
+    MemoryPrinter orig_dump(options.dump_width,
+                            with_shadow && options.dump_hide_equal,
+                            with_shadow ? options.dump_area : DumpArea::actual,
+                            options.color);
+    orig_dump.set_diff(&ranges, stack);
+    orig_dump.print_header();
+
+    for (size_t i = 0; i < header.shown; ++i) {
+        auto const& frame = report.frames[report.shown[i]];
+        orig_dump.caption("above is frame of: %16p = %s\n", pointer(frame.callee), name(frame.callee).c_str());
+        auto const actual = report.bytes + report.shown_offsets[i];
+        auto const shadow = with_shadow ? actual + padded(frame.size) : nullptr;
+        orig_dump.dump(stack + frame.position, shadow, frame.size, true, true, actual);
+    }
+    orig_dump.flush(out);
+
+    print_backtrace();
+}
+
+} // namespace shst
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "compare.hpp"
+#include "config.hpp"
+#include "symbolizer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace shst {
+
+// Corruption report as a compact binary record: everything the text report shows (frames, differences, raw bytes
+// of the actual stack and its shadow, backtrace), but no text. A record is built by the thread which found the
+// corruption and rendered later, possibly by another process (shst-report), into exactly the text it would have
+// printed itself.
+//
+// Layout: ReportHeader followed by arrays, in this order and each padded to 8 bytes:
+//   ReportFrame     frames[frames]       all frames of the stack, newest first
+//   ReportWatch     watch                watch hits only
+//   ReportSuppressed suppressed[frames]  summaries only, frames are the sites then
+//   uint64_t        corrupted[corrupted] indexes into frames
+//   ReportWord      words[words]         return address mode mismatches
+//   DiffRange       ranges[ranges]       differences, offsets from `stack`
+//   uint64_t        shown[shown]         indexes into frames, these get dumped
+//   uint8_t         bytes                actual (and shadow if with_shadow) bytes of every shown frame
+//   uint64_t        backtrace[backtrace]
+//   modules[modules]                     { ReportModule, char path[path_length], uint8_t build_id[build_id_length] }
+//   names[names]                         { uint64_t address, uint64_t length, char name[length] }
+// Names of callees and backtrace addresses are the last thing added, by whoever writes the record out. Offline records
+// (SHST_SYMBOLIZE=offline) get the objects loaded into the process instead and are named by shst-report, with symbols
+// from debug files found by build-id.
+
+constexpr uint32_t report_magic = 0x52534853; // "SHSR"
+constexpr char report_file_magic[8] = "SHSTREP";
+
+enum class ReportKind : uint32_t
+{
+    check = 1,
+    watch_hit = 2,
+    // reports suppressed by SHST_REPORT_LIMIT
+    summary = 3
+};
+
+enum class ReportDirection : uint32_t
+{
+    pre_call,
+    post_return,
+    suspension
+};
+
+enum ReportFlags : uint32_t
+{
+    report_keep_copy = 1,
+    report_with_shadow = 2,
+    report_offline = 4
+};
+
+struct ReportHeader
+{
+    uint32_t magic;
+    // of the whole record, a multiple of 8
+    uint32_t size;
+    ReportKind kind;
+    ReportDirection direction;
+    CheckMode check_mode;
+    uint32_t flags;
+    // SHST_DUMP_* of the reporting process
+    int32_t dump_width;
+    DumpArea dump_area;
+    uint32_t dump_hide_equal;
+    DumpColor dump_color;
+    uint32_t frames;
+    uint32_t corrupted;
+    uint32_t words;
+    uint32_t ranges;
+    uint32_t shown;
+    uint32_t backtrace;
+    uint32_t names;
+    uint32_t modules;
+    // address of stack position 0
+    uint64_t stack;
+    uint64_t thread;
+    // CLOCK_REALTIME, ns
+    uint64_t time;
+};
+
+struct ReportFrame
+{
+    uint64_t callee;
+    uint64_t position;
+    uint64_t size;
+};
+
+struct ReportWatch
+{
+    uint64_t return_address;
+    uint64_t slot;
+    uint64_t corrupted;
+    uint64_t next_instruction;
+};
+
+struct ReportWord
+{
+    uint64_t position;
+    uint64_t return_address;
+    uint64_t actual;
+    uint64_t expected;
+    uint64_t callee;
+};
+
+struct ReportSuppressed
+{
+    // since the previous summary
+    uint64_t suppressed;
+    uint64_t total;
+};
+
+struct ReportModule
+{
+    uint64_t bias;
+    uint64_t begin;
+    uint64_t end;
+    uint32_t path_length;
+    uint32_t build_id_length;
+};
+
+// Writes a record into `out`, or just counts its size with `out` null, so it can be done twice: to learn how much
+// room to reserve and then for real.
+class ReportEncoder
+{
+  public:
+    explicit ReportEncoder(uint8_t* out = nullptr)
+        : out{out}
+    {
+    }
+
+    template <class T>
+    void put(T const* items, size_t count)
+    {
+        put_bytes(items, sizeof(T) * count);
+    }
+
+    // padded to 8 bytes
+    void put_bytes(void const* bytes, size_t length);
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return written;
+    }
+
+  private:
+    uint8_t* const out;
+    size_t written = 0;
+};
+
+// Record taken apart, pointing into its bytes.
+struct Report
+{
+    ReportHeader const* header;
+    ReportFrame const* frames;
+    ReportWatch const* watch;
+    ReportSuppressed const* suppressed;
+    uint64_t const* corrupted;
+    ReportWord const* words;
+    DiffRange const* ranges;
+    uint64_t const* shown;
+    // shown[i] starts at bytes[shown_offsets[i]]
+    uint8_t const* bytes;
+    std::vector<size_t> shown_offsets;
+    uint64_t const* backtrace;
+    // with file being the path
+    std::vector<LoadedObject> modules;
+    // size of everything before the names
+    size_t unnamed_size;
+    std::unordered_map<uint64_t, std::string> names;
+};
+
+// false when `size` bytes at `record` are not a complete, consistent record
+[[nodiscard]] bool decode(uint8_t const* record, size_t size, Report& report);
+
+// text for an address, the way backtrace_symbols() (or with `line` backtrace_symbols_fd()) gives it
+using Namer = std::function<std::string(uint64_t address, bool line)>;
+
+// copy of the record with names of all the addresses in it, replacing any there were
+std::vector<uint8_t> add_names(uint8_t const* record, size_t size, Namer const& namer);
+
+// the same, looked up in this process
+std::vector<uint8_t> add_names(uint8_t const* record, size_t size);
+
+// copy of the record with the objects loaded into this process, for offline symbolization
+std::vector<uint8_t> add_modules(uint8_t const* record, size_t size);
+
+// what the record needs before it can be written out: names, or the loaded objects when it's an offline one
+std::vector<uint8_t> complete(uint8_t const* record, size_t size);
+
+// name of the address in the record, object and offset when there is none (offline records), "<unknown_callee>"
+// when not even that is known
+std::string name_of(Report const& report, uint64_t address, bool line = false);
+
+struct RenderOptions
+{
+    int dump_width;
+    DumpArea dump_area;
+    bool dump_hide_equal;
+    bool color;
+};
+
+// as the reporting process had them set, automatic color depending on whether `tty` is a terminal
+RenderOptions render_options(ReportHeader const& header, int tty);
+
+// the text report, the same what the reporting process printed (or would have printed) to stderr
+void render(Report const& report, RenderOptions const& options, FILE* out);
+
+} // namespace shst
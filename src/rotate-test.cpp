@@ -0,0 +1,63 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+// Checks look at the newest frame only, plus `rotate` deeper frames taking turns. A corruption of a frame 50
+// levels down has to be found within ceil(frames below the newest one / rotate) checks.
+
+constexpr int depth = 50;
+constexpr size_t rotate = 4;
+
+int found_after = -1;
+int bound = -1;
+
+int leaf(int x)
+{
+    return x + 1;
+}
+
+int hunt(int volatile* victim)
+{
+    shst_stats before, now;
+    shst_get_thread_stats(&before);
+    // frames of descend() and the one of leaf() on top of them, minus the newest which is checked every time
+    auto const frames_below = depth + 2 - 1;
+    bound = (frames_below + rotate - 1) / rotate;
+
+    *victim += 1;
+    for (int i = 0; i < 1000; ++i) {
+        shst::invoke(leaf, i);
+        shst_get_thread_stats(&now);
+        if (now.failed_checks != before.failed_checks) {
+            found_after = now.sampled_checks - before.sampled_checks;
+            break;
+        }
+    }
+    *victim -= 1;
+    return 0;
+}
+
+int descend(int level, int volatile* victim)
+{
+    int volatile local[16]{level};
+    if (level == 0) {
+        victim = local;
+    }
+    if (level < depth) {
+        return shst::invoke(descend, level + 1, victim) + local[0];
+    }
+    return hunt(victim);
+}
+
+int main()
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+    shst_set_check_rotate(rotate);
+
+    shst::invoke(descend, 0, nullptr);
+
+    printf("corruption %d frames deep found after %d checks (bound %d)\n", depth, found_after, bound);
+    return found_after > 0 && found_after <= bound ? 0 : 1;
+}
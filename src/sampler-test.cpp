@@ -0,0 +1,50 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <cstdio>
+
+// Sampling is stratified per callee: a hot callee gets checked on its first `rate` calls and then on every
+// `rate`-th one, a rare callee on every call. Both checks of a call are done or skipped together.
+
+constexpr unsigned rate = 10;
+constexpr unsigned hot_calls = 1000;
+constexpr unsigned rare_calls = 3;
+
+int hot(int x)
+{
+    return x + 1;
+}
+
+int rare(int x)
+{
+    return x - 1;
+}
+
+int main()
+{
+    shst_set_sample_rate(rate);
+
+    int sum = 0;
+    for (unsigned i = 0; i < hot_calls; ++i) {
+        sum += shst::invoke(hot, i);
+    }
+    for (unsigned i = 0; i < rare_calls; ++i) {
+        sum += shst::invoke(rare, i);
+    }
+
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+
+    auto const hot_sampled = rate + (hot_calls - 1) / rate;
+    auto const expected_calls = hot_calls + rare_calls;
+    auto const expected_sampled = 2 * (hot_sampled + rare_calls);
+    auto const expected_skipped = 2 * expected_calls - expected_sampled;
+
+    printf("calls: %llu (expected %u)\n", stats.calls, expected_calls);
+    printf("sampled checks: %llu (expected %u)\n", stats.sampled_checks, expected_sampled);
+    printf("skipped checks: %llu (expected %u)\n", stats.skipped_checks, expected_skipped);
+
+    return sum && stats.calls == expected_calls && stats.sampled_checks == expected_sampled &&
+                           stats.skipped_checks == expected_skipped
+                   ? 0
+                   : 1;
+}
@@ -0,0 +1,64 @@
+#include "sampler.hpp"
+
+namespace shst {
+
+namespace {
+
+constexpr size_t initial_capacity = 256;
+
+size_t bucket(void const* callee, size_t capacity)
+{
+    // code addresses are aligned and close to each other, spread them with a Fibonacci hash
+    auto const hash = (reinterpret_cast<uintptr_t>(callee) >> 2) * UINT64_C(0x9e3779b97f4a7c15);
+    return (hash >> 32) & (capacity - 1);
+}
+
+} // namespace
+
+Sampler::Sampler(uint32_t rate)
+{
+    set_rate(rate);
+}
+
+void Sampler::set_rate(uint32_t rate) noexcept
+{
+    sample_rate = rate ? rate : 1;
+}
+
+uint64_t& Sampler::counter(void const* callee)
+{
+    if (entries.empty() || (used + 1) * 2 > entries.size()) {
+        grow();
+    }
+    auto const mask = entries.size() - 1;
+    for (auto i = bucket(callee, entries.size());; i = (i + 1) & mask) {
+        auto& entry = entries[i];
+        if (entry.callee == callee) {
+            return entry.calls;
+        }
+        if (!entry.callee) {
+            entry.callee = callee;
+            ++used;
+            return entry.calls;
+        }
+    }
+}
+
+void Sampler::grow()
+{
+    std::vector<Entry> old(entries.empty() ? initial_capacity : entries.size() * 2);
+    old.swap(entries);
+    auto const mask = entries.size() - 1;
+    for (auto const& entry : old) {
+        if (!entry.callee) {
+            continue;
+        }
+        auto i = bucket(entry.callee, entries.size());
+        while (entries[i].callee) {
+            i = (i + 1) & mask;
+        }
+        entries[i] = entry;
+    }
+}
+
+} // namespace shst
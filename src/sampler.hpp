@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace shst {
+
+// Decides which guarded calls get checked, stratified per callee.
+//
+// Every callee has a call counter of its own. The first `rate` calls of a callee are all checked and from then
+// on only every `rate`-th one, so rarely called functions are always verified while the hot ones pay for a
+// fraction of their calls only.
+class Sampler
+{
+  public:
+    explicit Sampler(uint32_t rate = 1);
+
+    [[nodiscard]] uint32_t rate() const noexcept
+    {
+        return sample_rate;
+    }
+
+    // 0 and 1 both mean every call gets checked
+    void set_rate(uint32_t rate) noexcept;
+
+    [[nodiscard]] bool sample(void const* callee)
+    {
+        if (sample_rate == 1) {
+            return true;
+        }
+        auto const calls = counter(callee)++;
+        return calls < sample_rate || calls % sample_rate == 0;
+    }
+
+  private:
+    struct Entry
+    {
+        void const* callee;
+        uint64_t calls;
+    };
+
+    [[nodiscard]] uint64_t& counter(void const* callee);
+    void grow();
+
+    uint32_t sample_rate;
+    size_t used{};
+    // open addressing with linear probing, size is a power of two
+    std::vector<Entry> entries;
+};
+
+} // namespace shst
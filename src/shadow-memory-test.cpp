@@ -0,0 +1,87 @@
+#include "shadow-stack.hpp"
+#include <array>
+#include <cstdio>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+// Spawns a lot of threads, makes each one do a guarded call and measures how much RSS
+// they cost while all of them are alive. Shadow memory is committed lazily, so a thread
+// should only pay for the part of its stack it actually used, not for the whole stack size.
+
+constexpr int threads_count = 500;
+constexpr size_t max_rss_per_thread = 256 * 1024;
+
+pthread_barrier_t threads_ready;
+pthread_barrier_t rss_measured;
+
+size_t rss()
+{
+    size_t total{}, resident{};
+    if (auto statm = fopen("/proc/self/statm", "r")) {
+        if (fscanf(statm, "%zu %zu", &total, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+int leaf(unsigned* data)
+{
+    return data[0] + 1;
+}
+
+int nested(unsigned* data)
+{
+    std::array<unsigned, 256> local{};
+    local[0] = data[0];
+    return shst::invoke(leaf, local.data());
+}
+
+void* worker(void*)
+{
+    std::array<unsigned, 256> data{};
+    shst::invoke(nested, data.data());
+    pthread_barrier_wait(&threads_ready);
+    pthread_barrier_wait(&rss_measured);
+    return nullptr;
+}
+
+int main()
+{
+    pthread_barrier_init(&threads_ready, nullptr, threads_count + 1);
+    pthread_barrier_init(&rss_measured, nullptr, threads_count + 1);
+
+    std::array<unsigned, 256> data{};
+    shst::invoke(nested, data.data());
+
+    auto const before = rss();
+
+    std::vector<pthread_t> threads(threads_count);
+    for (auto& thread : threads) {
+        if (pthread_create(&thread, nullptr, worker, nullptr) != 0) {
+            perror("pthread_create");
+            return 2;
+        }
+    }
+    pthread_barrier_wait(&threads_ready);
+    auto const after = rss();
+    pthread_barrier_wait(&rss_measured);
+
+    for (auto& thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+
+    auto const per_thread = (after > before ? after - before : 0) / threads_count;
+    printf("RSS before: %zu kB, with %d threads: %zu kB, per thread: %zu kB (limit %zu kB)\n",
+           before / 1024,
+           threads_count,
+           after / 1024,
+           per_thread / 1024,
+           max_rss_per_thread / 1024);
+
+    pthread_barrier_destroy(&threads_ready);
+    pthread_barrier_destroy(&rss_measured);
+    return per_thread <= max_rss_per_thread ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+#include "shadow-memory.hpp"
+#include "config.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace shst {
+
+namespace {
+
+// commit in bigger steps than single pages to keep mprotect() off the hot path,
+// committing does not make pages resident so this costs nothing in RSS
+constexpr size_t commit_step = 64 * 1024;
+
+size_t page_size()
+{
+    static size_t const size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+size_t round_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+size_t round_down(size_t value, size_t alignment)
+{
+    return value / alignment * alignment;
+}
+
+// Lock-free pool of shadow regions left behind by exited threads.
+//
+// Regions are grouped in buckets keyed by reserved size, a bucket is claimed by the first region of its size and
+// never given back. Every slot is taken and filled with a single atomic exchange/CAS, so there is no ABA problem
+// to worry about and a region is always owned by exactly one party.
+class ShadowMemoryPool
+{
+  public:
+    struct Region
+    {
+        uint8_t* base;
+        size_t committed_from;
+    };
+
+    [[nodiscard]] bool enabled()
+    {
+        auto const state = enabled_state.load(std::memory_order_relaxed);
+        return state == State::configured ? config().shadow_pool : state == State::enabled;
+    }
+
+    void set_enabled(bool enabled)
+    {
+        enabled_state.store(enabled ? State::enabled : State::disabled, std::memory_order_relaxed);
+        if (!enabled) {
+            drain();
+        }
+    }
+
+    [[nodiscard]] Region* acquire(size_t reserved)
+    {
+        if (!enabled()) {
+            return nullptr;
+        }
+        for (auto& bucket : buckets) {
+            auto const size = bucket.size.load(std::memory_order_acquire);
+            if (size == 0) {
+                // buckets are claimed in order, there are no more after first empty one
+                return nullptr;
+            }
+            if (size != reserved) {
+                continue;
+            }
+            for (auto& slot : bucket.slots) {
+                if (slot.load(std::memory_order_relaxed)) {
+                    if (auto region = slot.exchange(nullptr, std::memory_order_acquire)) {
+                        return region;
+                    }
+                }
+            }
+            return nullptr;
+        }
+        return nullptr;
+    }
+
+    // takes ownership of the region on success
+    [[nodiscard]] bool release(Region* region, size_t reserved)
+    {
+        if (!enabled()) {
+            return false;
+        }
+        for (auto& bucket : buckets) {
+            auto size = bucket.size.load(std::memory_order_acquire);
+            if (size == 0 && bucket.size.compare_exchange_strong(size, reserved, std::memory_order_acq_rel)) {
+                size = reserved;
+            }
+            if (size != reserved) {
+                continue;
+            }
+            for (auto& slot : bucket.slots) {
+                Region* expected = nullptr;
+                if (slot.compare_exchange_strong(expected, region, std::memory_order_release)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return false;
+    }
+
+  private:
+    enum class State
+    {
+        // SHST_SHADOW_POOL decides, until set_enabled()
+        configured,
+        enabled,
+        disabled
+    };
+
+    void drain()
+    {
+        for (auto& bucket : buckets) {
+            auto const size = bucket.size.load(std::memory_order_acquire);
+            for (auto& slot : bucket.slots) {
+                if (auto region = slot.exchange(nullptr, std::memory_order_acquire)) {
+                    munmap(region->base, size);
+                    delete region;
+                }
+            }
+        }
+    }
+
+    struct Bucket
+    {
+        std::atomic<size_t> size{};
+        std::array<std::atomic<Region*>, 64> slots{};
+    };
+
+    std::atomic<State> enabled_state{State::configured};
+    std::array<Bucket, 8> buckets{};
+};
+
+// trivially destructible on purpose: thread_local shadows of the main thread may be released after static
+// destructors have already run, pooled regions are simply left for the OS to reclaim
+ShadowMemoryPool pool;
+
+} // namespace
+
+ShadowMemory::ShadowMemory(size_t size)
+    : base{nullptr}
+    , reserved{round_up(size, page_size())}
+    , requested{size}
+    , committed_from{reserved}
+{
+    if (reserved == 0) {
+        return;
+    }
+    if (auto region = pool.acquire(reserved)) {
+        base = region->base;
+        committed_from = region->committed_from;
+        delete region;
+        return;
+    }
+    auto const mapping = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    base = static_cast<uint8_t*>(mapping);
+}
+
+ShadowMemory::~ShadowMemory()
+{
+    if (!base) {
+        return;
+    }
+    auto region = new (std::nothrow) ShadowMemoryPool::Region{base, committed_from};
+    if (region && pool.release(region, reserved)) {
+        return;
+    }
+    delete region;
+    munmap(base, reserved);
+}
+
+void ShadowMemory::commit_slow(size_t position)
+{
+    auto const from = round_down(position, commit_step);
+    if (mprotect(base + from, committed_from - from, PROT_READ | PROT_WRITE) != 0) {
+        perror("shadow stack: cannot commit shadow memory");
+        abort();
+    }
+    committed_from = from;
+}
+
+void ShadowMemory::prefault(size_t position)
+{
+    if (position >= requested) {
+        return;
+    }
+    commit(position);
+    for (auto page = round_down(position, page_size()); page < requested; page += page_size()) {
+        auto volatile* byte = base + page;
+        *byte = *byte;
+    }
+}
+
+void set_shadow_pool_enabled(bool enabled)
+{
+    pool.set_enabled(enabled);
+}
+
+} // namespace shst
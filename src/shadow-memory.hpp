@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace shst {
+
+// Backing store for a shadow copy of a stack.
+//
+// Address space for the whole stack is reserved up front, but pages are only made accessible (and so can only
+// ever become resident) as positions closer to the stack limit get reached. Stacks grow downwards, so the
+// committed part is always [committed_from, reserved).
+//
+// Unless disabled, regions of exited threads are parked in a process-wide pool and handed over to new threads
+// with a stack of the same size, together with pages which are already committed and resident.
+class ShadowMemory
+{
+  public:
+    explicit ShadowMemory(size_t size);
+    ~ShadowMemory();
+
+    ShadowMemory(ShadowMemory const&) = delete;
+    ShadowMemory& operator=(ShadowMemory const&) = delete;
+
+    [[nodiscard]] uint8_t* data() noexcept
+    {
+        return base;
+    }
+
+    [[nodiscard]] uint8_t const* data() const noexcept
+    {
+        return base;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return requested;
+    }
+
+    [[nodiscard]] size_t committed() const noexcept
+    {
+        return reserved - committed_from;
+    }
+
+    // make [position, size) accessible
+    void commit(size_t position)
+    {
+        if (position < committed_from) {
+            commit_slow(position);
+        }
+    }
+
+    // commit [position, size) and fault its pages in right away rather than on first use, keeps the content
+    void prefault(size_t position);
+
+  private:
+    void commit_slow(size_t position);
+
+    uint8_t* base;
+    size_t reserved;
+    size_t requested;
+    size_t committed_from;
+};
+
+void set_shadow_pool_enabled(bool enabled);
+
+} // namespace shst
@@ -6,7 +6,56 @@ extern "C" {
 #endif
 
 typedef void* (*shst_f)(void* x0, void* x1, void* x2, void* x3, void* x4, void* x5, void* x6, void* x7);
+
+// __builtin_call_with_static_chain() is there in C only (GCC 5 on, clang)
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__cplusplus)
+#define SHST_INVOKE_TRAMPOLINE 1
+#endif
+
+#ifdef SHST_INVOKE_TRAMPOLINE
+// shst_trampoline(), see shadow-stack.h
+extern void (*const shst_trampoline_pointer)(void);
+
+// any signature: floating point, stack and variadic arguments, struct and long double returns (see shst_trampoline)
+#define shst_invoke(f, ...)                                                                                  \
+    __builtin_call_with_static_chain(((__typeof__(&*(f)))shst_trampoline_pointer)(__VA_ARGS__), (f))
+#else
+// up to 8 pointer-sized arguments and a pointer-sized result (see shst_invoke_impl)
 #define shst_invoke(f, ...) (typeof(f(__VA_ARGS__)))shst_invoke_impl((shst_f)f, ##__VA_ARGS__)
+#endif
+
+// how shadow frames are verified, see SHST_CHECK_MODE
+typedef enum shst_check_mode
+{
+    SHST_CHECK_EXACT,          // byte for byte comparison with a shadow copy
+    SHST_CHECK_FINGERPRINT,    // per-frame fingerprints, shadow copy is optional
+    SHST_CHECK_WATCH,          // hardware watchpoints on return addresses of the newest frames
+    SHST_CHECK_RETURN_ADDRESS, // saved frame pointers and return addresses only
+} shst_check_mode;
+
+// counters of the calling thread, see shst_get_thread_stats()
+typedef struct shst_stats
+{
+    unsigned long long calls;              // guarded calls
+    unsigned long long sampled_checks;     // checks done
+    unsigned long long skipped_checks;     // checks skipped by sampling, see SHST_SAMPLE_RATE
+    unsigned long long failed_checks;      // checks which found a corruption, whatever the reaction
+    unsigned long long elided_checks;      // pre-call checks cut short, the previous post-return one covered it
+    unsigned long long suppressed_reports; // reports not made in full, see SHST_REPORT_LIMIT
+} shst_stats;
+
+// overhead governor of the calling thread, see shst_get_governor_state()
+typedef struct shst_governor_state
+{
+    double budget;                  // target fraction of wall time, 0 when the governor is off
+    double overhead;                // fraction measured in the last finished window
+    unsigned level;                 // 0 runs configured settings, every level up makes checks cheaper
+    unsigned long long check_depth; // currently applied, 0 is full depth
+    unsigned sample_rate;           // currently applied
+} shst_governor_state;
+
+// a stack registered with shst_stack_register(), e.g. of a fiber
+typedef struct shst_stack shst_stack;
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,130 @@
+#pragma once
+
+// C++20 coroutines, the rest of the library is C++17
+
+#include "shadow-stack.hpp"
+#include <coroutine>
+#include <type_traits>
+#include <utility>
+
+namespace shst {
+namespace detail {
+
+template <class Awaitable>
+decltype(auto) get_awaiter(Awaitable&& awaitable)
+{
+    if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); }) {
+        return std::forward<Awaitable>(awaitable).operator co_await();
+    } else if constexpr (requires { operator co_await(std::forward<Awaitable>(awaitable)); }) {
+        return operator co_await(std::forward<Awaitable>(awaitable));
+    } else {
+        return std::forward<Awaitable>(awaitable);
+    }
+}
+
+} // namespace detail
+
+// Guards the body of a coroutine: a guard on the stack (shst::invoke) would stay pushed while the coroutine is
+// suspended and its frame would be long gone (or reused by someone else) by the time the coroutine resumes,
+// possibly on another thread. co_guard pops the frame on every suspension and pushes a new one on resumption, at
+// whatever depth of whichever stack the coroutine is resumed from. Suspending checks the frame of the coroutine
+// only, so the cost of a co_await is bounded by what ran since the resumption, not by the depth of the stack.
+//
+//     task<int> fetch(connection& c)
+//     {
+//         shst::co_guard guard{fetch, c};
+//         auto reply = co_await guard.await(c.read());
+//         ...
+//     }
+//
+// Only co_awaits wrapped in await() are known to the guard, a plain co_await in a guarded coroutine leaves a stale
+// frame behind.
+//
+// The guard and its awaiters live in the coroutine frame on the heap, their own addresses say nothing about the
+// stack. The frames start at the frame address of the coroutine body instead: whatever it spills on the stack while
+// running belongs to the coroutine, not to whoever resumed it. That is why everything here is always inlined.
+class co_guard
+{
+  public:
+    template <class F, class... Args>
+    [[gnu::always_inline]] explicit co_guard(F&& f, Args&&... args)
+        : callee{callee_traits::address(std::forward<F>(f), std::forward<Args>(args)...)}
+    {
+        pushed = detail::enabled.load(std::memory_order_relaxed) && detail::enter(callee, __builtin_frame_address(0));
+    }
+
+    co_guard(co_guard const&) = delete;
+    co_guard& operator=(co_guard const&) = delete;
+
+    [[gnu::always_inline]] ~co_guard()
+    {
+        if (pushed) {
+            detail::leave(__builtin_frame_address(0));
+        }
+    }
+
+    template <class Awaitable>
+    class awaiter
+    {
+      public:
+        awaiter(co_guard& guard, Awaitable&& awaitable)
+            : guard{guard}
+            , awaitable{std::forward<Awaitable>(awaitable)}
+            , inner{detail::get_awaiter(std::forward<Awaitable>(this->awaitable))}
+        {
+        }
+
+        bool await_ready()
+        {
+            return inner.await_ready();
+        }
+
+        template <class Promise>
+        [[gnu::always_inline]] auto await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            // whoever gets the handle may resume it right away, even before await_suspend returns
+            guard.suspend();
+            return inner.await_suspend(handle);
+        }
+
+        [[gnu::always_inline]] decltype(auto) await_resume()
+        {
+            guard.resume();
+            return inner.await_resume();
+        }
+
+      private:
+        co_guard& guard;
+        // kept alive for the whole co_await, a reference for lvalues
+        Awaitable awaitable;
+        decltype(detail::get_awaiter(std::declval<Awaitable>())) inner;
+    };
+
+    template <class Awaitable>
+    awaiter<Awaitable> await(Awaitable&& awaitable)
+    {
+        return {*this, std::forward<Awaitable>(awaitable)};
+    }
+
+  private:
+    [[gnu::always_inline]] void suspend()
+    {
+        if (pushed) {
+            detail::suspend(__builtin_frame_address(0));
+            pushed = false;
+        }
+    }
+
+    [[gnu::always_inline]] void resume()
+    {
+        // not suspended at all when the awaitable was ready
+        if (!pushed && detail::enabled.load(std::memory_order_relaxed)) {
+            pushed = detail::resume(callee, __builtin_frame_address(0));
+        }
+    }
+
+    void* const callee;
+    bool pushed = false;
+};
+
+} // namespace shst
@@ -1,5 +1,8 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
 #include <cstddef>
 #include <cassert>
 #include <cstdint>
@@ -7,14 +10,30 @@
 #include <cstring>
 #include <ctime>
 #include <execinfo.h>
+#include <link.h>
 #include <iterator>
+#include <memory>
 #include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 #include "shadow-stack.hpp"
-#include "shadow-stack-common.h"
+#include "shadow-stack.h"
+#include "config.hpp"
+#include "shadow-memory.hpp"
+#include "fingerprint.hpp"
+#include "compare.hpp"
+#include "watchpoints.hpp"
+#include "sampler.hpp"
+#include "governor.hpp"
 #include "callee_traits.hpp"
+#include "report.hpp"
+#include "report-limiter.hpp"
+#include "report-writer.hpp"
+#include "library-attach.hpp"
 
 #ifdef HAVE_LIBUNWIND
 #define UNW_LOCAL_ONLY
@@ -23,11 +42,6 @@
 
 namespace shst {
 
-// ANSI color codes for hex dump differences
-static constexpr const char* ANSI_RED_BLINK = "\033[5;41m";
-static constexpr const char* ANSI_GREEN_BLINK = "\033[5;42m";
-static constexpr const char* ANSI_RESET = "\033[0m";
-
 class Stack
 {
   public:
@@ -110,73 +124,211 @@ class StackBase final : public Stack
     size_t const stack_size;
 };
 
+// Threads other than main keep their descriptor and static TLS blocks at the top of the stack mapping (glibc,
+// musl), these are not stack frames and change on their own, so the usable stack ends right below them.
+uint8_t* static_tls_begin(uint8_t* stack_begin, uint8_t* stack_end)
+{
+    struct Range
+    {
+        uint8_t* begin;
+        uint8_t* end;
+
+        void clamp(void* p)
+        {
+            auto u8p = static_cast<uint8_t*>(p);
+            if (begin < u8p && u8p < end) {
+                end = u8p;
+            }
+        }
+    } range{stack_begin, stack_end};
+
+    range.clamp(reinterpret_cast<void*>(pthread_self()));
+    dl_iterate_phdr(
+            [](dl_phdr_info* info, size_t, void* data) {
+                static_cast<Range*>(data)->clamp(info->dlpi_tls_data);
+                return 0;
+            },
+            &range);
+    return range.end;
+}
+
 StackBase makeStackBase()
 {
     pthread_attr_t attr;
     void* stackaddr{};
     size_t stacksize{};
 
+    // expensive on the main thread (glibc parses /proc/self/maps), see shst_thread_attach()
     pthread_getattr_np(pthread_self(), &attr);
     pthread_attr_getstack(&attr, &stackaddr, &stacksize);
+    pthread_attr_destroy(&attr);
+
+    auto const begin = static_cast<uint8_t*>(stackaddr);
+    auto const end = static_tls_begin(begin, begin + stacksize);
+    return {stackaddr, static_cast<size_t>(end - begin)};
+}
+
+// Calls `f` with every frame record (saved frame pointer followed by return address) within [sp, end), newest
+// first, found by walking the frame pointer chain of the calling thread. Stops early when `f` returns false.
+// Only reliable when everything between here and `end` keeps frame pointers.
+template <class F>
+void for_each_frame_record(uint8_t const* sp, uint8_t const* end, F&& f)
+{
+    auto fp = static_cast<void**>(__builtin_frame_address(0));
+    while (reinterpret_cast<uint8_t const*>(fp + 2) <= end) {
+        if (reinterpret_cast<uint8_t const*>(fp) >= sp && !f(fp)) {
+            return;
+        }
+        auto const next = static_cast<void**>(*fp);
+        if (next <= fp) {
+            // not a frame chain (anymore)
+            return;
+        }
+        fp = next;
+    }
+}
 
-    return {stackaddr, stacksize};
+// slot holding the return address of the function which owns the stack at `sp`
+void** return_address_slot(uint8_t const* sp, uint8_t const* end)
+{
+    void** slot = nullptr;
+    for_each_frame_record(sp, end, [&](void** record) {
+        slot = record + 1;
+        return false;
+    });
+    return slot;
 }
 
 class StackShadow final : public Stack
 {
   public:
-    StackShadow()
-        : orig{makeStackBase()}
-        , shadow(orig.size())
+    explicit StackShadow(Config const& config)
+        : check_frames{config.check_depth}
+        , check_bytes{config.check_bytes}
+        , check_mode{config.check_mode}
+        , keep_copy{wants_copy()}
+        , sampler{config.sample_rate}
+        , rotate_frames{config.check_rotate}
     {
+        if (check_mode == CheckMode::watch && !start_watching()) {
+            check_mode = CheckMode::exact;
+            keep_copy = true;
+        }
+        // takes the mode and copy flag settled above
+        region = own_region = add_region(makeStackBase());
     }
 
-    [[nodiscard]] size_t size() const noexcept override
+    ~StackShadow()
     {
-        return shadow.size();
+        // whatever got suppressed since the last summary
+        report_summary(true);
     }
 
-    enum class Direction
+    [[nodiscard]] size_t size() const noexcept override
     {
-        PreCall,
-        PostReturn
-    };
+        return region->shadow.size();
+    }
+
+    // a stack known to the thread, with its own shadow and frames
+    struct Region;
 
-    enum class Reaction
+    // Makes the stack `stack_pointer` points into the current one, looking it up when it is not. Stacks are found
+    // among registered ones (the alternate signal stack once attached), false means an unknown stack.
+    [[nodiscard]] bool use_stack(void const* stack_pointer)
     {
-        ignore,
-        report_and_continue,
-        report_and_abort,
-        report_heal_and_continue,
-        heal_and_continue
-    };
+        return region->orig.caddress(stack_pointer) || find_stack(stack_pointer);
+    }
+
+    // nullptr when [begin, begin + size) overlaps a known stack
+    Region* add_stack(void* begin, size_t size);
+    // the alternate signal stack of the thread, if there is one, known so that signal handlers need not allocate
+    void add_signal_stack();
+    // fails for the thread's own stack and for stacks with frames on them
+    bool remove_stack(Region* stack);
+    // nullptr switches back to the thread's own stack
+    void switch_stack(Region* stack);
 
-    enum class DumpArea
+    enum class Direction
     {
-        both,
-        actual,
-        shadow
+        PreCall,
+        PostReturn,
+        // a coroutine leaving the stack, only its own frame gets verified
+        Suspension
     };
 
+    using Reaction = shst::Reaction;
+    using DumpArea = shst::DumpArea;
+    using CheckMode = shst::CheckMode;
+
     Reaction desired_reaction();
     int dump_width();
     DumpArea dump_area();
     bool dump_hide_equal_lines();
     bool should_use_color();
 
+    // gets shadow memory for the stack above `stack_pointer` (plus some headroom) ready for the first pushes
+    void prepare(void* stack_pointer);
     void push(void* callee, void* stack_pointer);
     void check(Direction);
+    // push + pre-call check in one go, the new frame has just been copied so only older frames get verified
+    void push_and_check(void* callee, void* stack_pointer);
     void pop();
 
+    // 0 means no limit, with both limits set the stricter one wins
+    void set_check_depth(size_t frames)
+    {
+        check_frames = frames;
+    }
+    void set_check_bytes(size_t bytes)
+    {
+        check_bytes = bytes;
+    }
+    // 0 turns rotation off
+    void set_check_rotate(size_t frames)
+    {
+        rotate_frames = frames;
+        region->rotation_cursor = 0;
+    }
+    void set_sample_rate(uint32_t rate)
+    {
+        sampler.set_rate(rate);
+    }
+    // guard-bench only, see detail::set_fused_push_check()
+    void set_fused_push_check(bool fused)
+    {
+        fused_push_check = fused;
+    }
+
+    [[nodiscard]] size_t check_depth() const noexcept
+    {
+        return check_frames;
+    }
+
+    [[nodiscard]] uint32_t sample_rate() const noexcept
+    {
+        return sampler.rate();
+    }
+
+    [[nodiscard]] shst_stats const& get_stats() const noexcept
+    {
+        return stats;
+    }
+
+    // returns the mode in effect, watch falls back to exact when hardware watchpoints are not available
+    CheckMode set_check_mode(CheckMode mode);
+
+    // SIGTRAP handler: only records the hit, handle_watch_hits() reports it on the next check
+    void watch_hit(void const* address, void const* next_instruction);
+
   protected:
     [[nodiscard]] void const* cstack() const noexcept override
     {
-        return shadow.data();
+        return region->shadow.data();
     }
 
     [[nodiscard]] void* stack() noexcept override
     {
-        return shadow.data();
+        return region->shadow.data();
     }
 
   private:
@@ -191,390 +343,708 @@ class StackShadow final : public Stack
         void const* const callee;
         size_t const position;
         size_t const size;
+        uint64_t fingerprint{};
+        // watch mode: return address of the function which made the guarded call, if found on the frame chain
+        void** return_slot{};
+        void* return_address{};
+        // return address mode: saved_words of this frame
+        size_t first_word{};
+        size_t words{};
+        // decided once at push, so both checks of a call are either done or skipped
+        bool sampled{true};
+    };
+
+    // word of a frame record (saved frame pointer or return address) as it was at push
+    struct SavedWord
+    {
+        size_t position;
+        void* value;
     };
 
-    StackBase const orig;
-    std::vector<uint8_t> shadow;
-    std::vector<StackFrame> stack_frames;
+    using FrameIterator = std::vector<StackFrame>::reverse_iterator;
+
+  public:
+    struct Region
+    {
+        explicit Region(StackBase orig)
+            : orig{orig}
+            , shadow(orig.size())
+        {
+        }
+
+        StackBase const orig;
+        ShadowMemory shadow;
+        std::vector<StackFrame> stack_frames;
+        // return address mode: frame records of all frames, oldest frame first
+        std::vector<SavedWord> saved_words;
+        size_t rotation_cursor{};
+        // Run on before this stack got entered by a guarded call, e.g. of a signal handler on the alternate stack,
+        // switched back to as its last frame is popped: the interrupted code goes on where it was.
+        Region* entered_from{};
+        // what the frames were captured for, see recapture()
+        CheckMode mode{};
+        bool has_copy{};
+        // in `regions`
+        size_t index{};
+    };
+
+  private:
+    [[nodiscard]] Region* add_region(StackBase orig);
+    [[nodiscard]] bool find_stack(void const* stack_pointer);
+    void recapture(Region& stack);
+
+    [[nodiscard]] size_t check_end() const;
+    [[nodiscard]] std::pair<size_t, size_t> rotation_range(size_t end);
+    [[nodiscard]] std::pair<FrameIterator, FrameIterator> frames_within(size_t begin, size_t end);
+    void verify(size_t begin, size_t end);
+    // verifies stack from `begin` on, the rest of the shadow frames is reported as usual
+    void check(Direction direction, size_t begin);
+    void fingerprints_match(size_t begin, size_t end);
+    void saved_words_match(size_t begin, size_t end);
+    void save_words(StackFrame& frame);
+    void expected_frame(StackFrame const& frame, std::vector<uint8_t>& buffer) const;
+    void heal();
+    [[nodiscard]] ReportHeader report_header(ReportKind kind);
+    // of the failed check, in whatever form SHST_REPORT_FILE asks for
+    void report(Direction direction, bool aborting);
+    [[nodiscard]] ReportLimiter::Site check_site(Direction direction) const;
+    // counts the report against SHST_REPORT_LIMIT, false when it is not to be made, summarizes suppressed ones
+    [[nodiscard]] bool admit_report(ReportLimiter::Site const& site, bool aborting);
+    // unless `final`, only once SHST_REPORT_SUMMARY passes since the previous one
+    void report_summary(bool final);
+    [[nodiscard]] bool wants_copy();
+    [[nodiscard]] bool start_watching();
+    void arm_watchpoints();
+    void handle_watch_hits();
+
+    // Registry of known stacks. Each of them is entered in `cells` under every 64 KiB cell of address space it
+    // touches, so finding the stack of a stack pointer takes a single hash lookup and a few range checks.
+    static constexpr unsigned cell_shift = 16;
+    std::vector<std::unique_ptr<Region>> regions;
+    std::unordered_multimap<uintptr_t, Region*> cells;
+    // the stack being run on, and the one the thread started with
+    Region* region{};
+    Region* own_region{};
+    size_t check_frames;
+    size_t check_bytes;
+    CheckMode check_mode;
+    // fingerprint mode may run without a shadow copy, then neither heal nor full diff is possible
+    bool keep_copy;
+    std::vector<StackFrame const*> corrupted_frames;
+    // positions of differing bytes found by the last failed check
+    DiffRanges diff_ranges;
+    // watch mode: frame `i` is watched with slot `i % capacity`, so the newest frames are always covered
+    Watchpoints watchpoints;
+    // Recorded by the SIGTRAP handler, which must not allocate, lock or print: the report path does all of it. A slot
+    // that got hit stays disarmed until its hit is handled, so there are never more hits than slots.
+    struct WatchHit
+    {
+        void* const* slot;
+        void const* corrupted;
+        void const* next_instruction;
+    };
+    std::array<WatchHit, Watchpoints::capacity> watch_hits{};
+    size_t volatile pending_watch_hits = 0;
+    Sampler sampler;
+    ReportLimiter limiter;
+    shst_stats stats{};
+    // rotation: frames below the checked top of the stack verified per check, index of the next one to verify
+    // counting from the oldest frame
+    size_t rotate_frames;
+    // Left behind by a clean post-return check: with `frames` frames on the stack everything from their top down to
+    // `end` was verified. Until the next push only the code of the newest frame runs, so the pre-call check of the
+    // next call at the same depth goes on from `end` (older frames corrupted in the meantime are still caught by the
+    // post-return check of that call). Any other check, and switching stacks, invalidates it.
+    struct Verified
+    {
+        size_t frames;
+        size_t end;
+    } verified{SIZE_MAX, 0};
+    // push_and_check() skips the frame it has just copied, otherwise it verifies from the new top like check()
+    bool fused_push_check = true;
 };
 
 StackShadow::Reaction StackShadow::desired_reaction()
 {
-    auto reaction = getenv("SHST_REACTION");
-    if (reaction == nullptr || strcmp(reaction, "abort") == 0) {
-        return Reaction::report_and_abort;
-    } else if (strcmp(reaction, "ignore") == 0) {
-        return Reaction::ignore;
-    } else if (strcmp(reaction, "report") == 0) {
-        return Reaction::report_and_continue;
-    } else if (strcmp(reaction, "heal") == 0) {
-        return Reaction::report_heal_and_continue;
-    } else if (strcmp(reaction, "quiet-heal") == 0) {
-        return Reaction::heal_and_continue;
-    } else {
-        // default
-        return Reaction::report_and_abort;
-    }
+    return config().reaction;
 }
 
 int StackShadow::dump_width()
 {
-    int width = 16;
-    if (auto env = getenv("SHST_DUMP_WIDTH")) {
-        width = std::atoi(env);
-        if (!width) {
-            width = 16;
-        }
-    }
-    return width;
+    return config().dump_width;
 }
 
 StackShadow::DumpArea StackShadow::dump_area()
 {
-    auto area = getenv("SHST_DUMP_AREA");
-    if (area == nullptr || strcmp(area, "both") == 0) {
-        return DumpArea::both;
-    } else if (strcmp(area, "actual") == 0) {
-        return DumpArea::actual;
-    } else if (strcmp(area, "shadow") == 0) {
-        return DumpArea::shadow;
-    } else {
-        return DumpArea::both;
-    }
+    return config().dump_area;
 }
 
 bool StackShadow::dump_hide_equal_lines()
 {
-    auto hide = getenv("SHST_DUMP_HIDE_EQUAL");
-    if (hide) {
-        if (strcasecmp(hide, "yes") == 0 || strcasecmp(hide, "true") == 0 || strcasecmp(hide, "1") == 0) {
+    return config().dump_hide_equal;
+}
+
+bool StackShadow::should_use_color()
+{
+    switch (config().dump_color) {
+        case DumpColor::always:
             return true;
-        }
+        case DumpColor::never:
+            return false;
+        default:
+            return isatty(STDERR_FILENO);
     }
-    return false;
 }
 
-bool StackShadow::should_use_color()
+void StackShadow::prepare(void* sp)
 {
-    auto color = getenv("SHST_DUMP_COLOR");
-    if (color == nullptr || strcmp(color, "auto") == 0) {
-        return isatty(STDERR_FILENO);
-    } else if (strcmp(color, "always") == 0) {
-        return true;
-    } else if (strcmp(color, "never") == 0) {
-        return false;
-    } else {
-        return isatty(STDERR_FILENO);
+    constexpr size_t headroom = 64 * 1024;
+    if (!keep_copy || !region->stack_frames.empty() || !region->orig.caddress(sp)) {
+        return;
     }
+    auto const position = region->orig.position(sp);
+    region->shadow.prefault(position > headroom ? position - headroom : 0);
 }
 
 void StackShadow::push(void* callee, void* sp)
 {
-    auto const last_stack_position = stack_frames.empty() ? orig.size() : stack_frames.back().position;
-    auto const orig_stack_pointer = orig.caddress(sp);
-    auto const stack_position = orig.position(sp);
+    auto const& frames = region->stack_frames;
+    auto const last_stack_position = frames.empty() ? region->orig.size() : frames.back().position;
+    auto const orig_stack_pointer = region->orig.caddress(sp);
+    auto const stack_position = region->orig.position(sp);
 
     assert(last_stack_position >= stack_position);
     auto const size = last_stack_position - stack_position;
 
     assert(size);
-    std::copy_n(orig_stack_pointer, size, address(stack_position));
+    if (keep_copy) {
+        region->shadow.commit(stack_position);
+        std::copy_n(orig_stack_pointer, size, address(stack_position));
+    }
 
-    stack_frames.emplace_back(callee, stack_position, size);
+    auto& frame = region->stack_frames.emplace_back(callee, stack_position, size);
+    frame.sampled = sampler.sample(callee);
+    ++stats.calls;
+    if (check_mode == CheckMode::fingerprint) {
+        frame.fingerprint = fingerprint(orig_stack_pointer, size);
+    } else if (check_mode == CheckMode::watch) {
+        frame.return_slot = return_address_slot(orig_stack_pointer, region->orig.caddress(last_stack_position));
+        frame.return_address = frame.return_slot ? *frame.return_slot : nullptr;
+        watchpoints.watch((region->stack_frames.size() - 1) % Watchpoints::capacity, frame.return_slot);
+    } else if (check_mode == CheckMode::return_address) {
+        save_words(frame);
+    }
 }
 
-struct MemoryPrinter
+void StackShadow::save_words(StackFrame& frame)
 {
-    MemoryPrinter(size_t line_lenght = 0,
-                  bool hide_equal_lines = false,
-                  StackShadow::DumpArea area = StackShadow::DumpArea::both,
-                  bool use_color = false)
-        : line_lenght(line_lenght)
-        , hide_equal_lines(hide_equal_lines)
-        , area(area)
-        , use_color(use_color)
-    {
+    frame.first_word = region->saved_words.size();
+    auto const base = region->orig.caddress();
+    auto const begin = base + frame.position;
+    for_each_frame_record(begin, begin + frame.size, [&](void** record) {
+        auto const position = reinterpret_cast<uint8_t const*>(record) - base;
+        region->saved_words.push_back({static_cast<size_t>(position), record[0]});
+        region->saved_words.push_back({position + sizeof(void*), record[1]});
+        return true;
+    });
+    frame.words = region->saved_words.size() - frame.first_word;
+}
+
+bool StackShadow::wants_copy()
+{
+    return check_mode == CheckMode::exact || (check_mode == CheckMode::fingerprint && config().fingerprint_copy);
+}
+
+void on_watch_hit(void const* address, void const* next_instruction);
+
+bool StackShadow::start_watching()
+{
+    if (watchpoints.open(on_watch_hit)) {
+        return true;
+    }
+    static std::atomic_flag warned = ATOMIC_FLAG_INIT;
+    if (!warned.test_and_set()) {
+        fprintf(stderr,
+                "shadow stack: hardware watchpoints not available (%s), falling back to exact check mode\n",
+                strerror(errno));
     }
+    return false;
+}
 
-    size_t line_lenght = 0;
-    bool hide_equal_lines = false;
-    StackShadow::DumpArea area = StackShadow::DumpArea::both;
-    bool use_color = false;
+// newest frames get the slots, older ones are left unwatched
+void StackShadow::arm_watchpoints()
+{
+    auto const frames = region->stack_frames.size();
+    for (size_t i = 0; i < Watchpoints::capacity && i < frames; ++i) {
+        auto const index = frames - 1 - i;
+        watchpoints.watch(index % Watchpoints::capacity, region->stack_frames[index].return_slot);
+    }
+    for (size_t i = frames; i < Watchpoints::capacity; ++i) {
+        watchpoints.watch(i, nullptr);
+    }
+}
 
-    void print_header()
-    {
-        if (area == StackShadow::DumpArea::both) {
-            fprintf(stderr,
-                    "                      %*s      %s\n",
-                    -static_cast<int>(line_lenght) * 5,
-                    "ACTUAL STACK (CORRUPTED):",
-                    "SHADOW STACK (CORRECT):");
-        } else if (area == StackShadow::DumpArea::actual) {
-            fprintf(stderr, "                      %s\n", "ACTUAL STACK (CORRUPTED):");
-        } else {
-            fprintf(stderr, "                      %s\n", "SHADOW STACK (CORRECT):");
-        }
+StackShadow::CheckMode StackShadow::set_check_mode(CheckMode mode)
+{
+    if (mode == CheckMode::watch && !start_watching()) {
+        mode = CheckMode::exact;
+    }
+    if (mode != CheckMode::watch) {
+        watchpoints.close();
     }
+    check_mode = mode;
+    verified.frames = SIZE_MAX;
+    keep_copy = wants_copy();
+    // other stacks are re-captured once switched to, frame records can only be found on the stack being run on
+    recapture(*region);
+    if (check_mode == CheckMode::watch) {
+        arm_watchpoints();
+    }
+    return check_mode;
+}
 
-    void dump(FILE* out,
-              const uint8_t* address,
-              const uint8_t* shadow,
-              size_t length,
-              bool with_address = true,
-              bool with_preview = true)
-    {
-        if (!address || !length) {
-            return;
-        }
-        if (!out) {
-            out = stderr;
+void StackShadow::recapture(Region& stack)
+{
+    auto const had_copy = stack.has_copy;
+    stack.mode = check_mode;
+    stack.has_copy = keep_copy;
+    stack.saved_words.clear();
+
+    // current state of the stack becomes the reference for whatever the new mode needs
+    for (auto& frame : stack.stack_frames) {
+        auto const orig_frame = stack.orig.caddress(frame.position);
+        if (keep_copy && !had_copy) {
+            stack.shadow.commit(frame.position);
+            std::copy_n(orig_frame, frame.size, stack.shadow.data() + frame.position);
         }
-        if (line_lenght == 0) {
-            line_lenght = 16;
+        if (check_mode == CheckMode::fingerprint) {
+            frame.fingerprint = fingerprint(orig_frame, frame.size);
+        } else if (check_mode == CheckMode::watch) {
+            frame.return_slot = return_address_slot(orig_frame, orig_frame + frame.size);
+            frame.return_address = frame.return_slot ? *frame.return_slot : nullptr;
+        } else if (check_mode == CheckMode::return_address) {
+            save_words(frame);
         }
+    }
+}
 
-        auto align_start = reinterpret_cast<uintptr_t>(address) % line_lenght;
-        const uint8_t* print_start = address - align_start;
-        auto align_end = reinterpret_cast<uintptr_t>(address + length) % line_lenght;
-        align_end = -align_end + (align_end ? line_lenght : 0);
-        const uint8_t* print_end = address + length + align_end;
-
-        int hidden_lines = 0;
-        int hidden_bytes = 0;
-        for (auto line_start = print_start; line_start < print_end; line_start += line_lenght) {
-            auto content_start = std::max(line_start, address);
-            auto content_end = std::min(line_start + line_lenght, address + length);
-            auto content_lenght = content_end - content_start;
-            auto content_offset = content_start - address;
-            auto line_differs = memcmp(content_start, shadow + content_offset, content_lenght);
-
-            if (hide_equal_lines && !line_differs) {
-                hidden_bytes += content_lenght;
-                hidden_lines += 1;
-                continue;
-            }
-            if (hidden_bytes || hidden_lines) {
-                fprintf(out, "    (%d equal bytes in %d lines hidden)\n", hidden_bytes, hidden_lines);
-                hidden_bytes = hidden_lines = 0;
-            }
+StackShadow::Region* StackShadow::add_region(StackBase orig)
+{
+    auto& stack = regions.emplace_back(std::make_unique<Region>(orig));
+    stack->index = regions.size() - 1;
+    stack->mode = check_mode;
+    stack->has_copy = keep_copy;
+    auto const begin = reinterpret_cast<uintptr_t>(orig.caddress());
+    for (auto cell = begin >> cell_shift; cell <= (begin + orig.size() - 1) >> cell_shift; ++cell) {
+        cells.emplace(cell, stack.get());
+    }
+    return stack.get();
+}
 
-            if (with_address) {
-                fprintf(out, "%c %16p |", line_differs ? '*' : ' ', line_start);
+StackShadow::Region* StackShadow::add_stack(void* begin, size_t size)
+{
+    auto const first = reinterpret_cast<uintptr_t>(begin);
+    auto const last = first + size - 1;
+    if (size == 0 || last < first) {
+        return nullptr;
+    }
+    for (auto cell = first >> cell_shift; cell <= last >> cell_shift; ++cell) {
+        auto const [known, end] = cells.equal_range(cell);
+        for (auto it = known; it != end; ++it) {
+            auto const other = reinterpret_cast<uintptr_t>(it->second->orig.caddress());
+            if (first < other + it->second->orig.size() && other <= last) {
+                return nullptr;
             }
+        }
+    }
+    return add_region(StackBase{begin, size});
+}
 
-            auto print_hex_section = [&](const uint8_t* data_source, const char* color_code, auto get_preview_char) {
-                bool prev_differs = false;
-                for (auto this_byte = line_start; this_byte < line_start + line_lenght; ++this_byte) {
-                    auto in_area = this_byte >= address && this_byte < address + length;
-                    if (in_area) {
-                        bool differs = shadow ? *this_byte != shadow[this_byte - address] : false;
-
-                        const char* prefix = " ";
-                        const char* suffix = "";
-                        const char* color_start = "";
-                        const char* color_end = "";
-                        const char* suffix_reset = "";
-
-                        if (differs && !prev_differs) {
-                            prefix = "[";
-                            color_start = use_color ? color_code : "";
-                        } else if (!differs && prev_differs) {
-                            prefix = "]";
-                            color_end = use_color ? ANSI_RESET : "";
-                        }
-
-                        bool is_last_char = (this_byte + 1 >= line_start + line_lenght) ||
-                                            (this_byte + 1 >= address + length);
-                        if (differs && is_last_char) {
-                            suffix = "]";
-                            suffix_reset = use_color ? ANSI_RESET : "";
-                        } else if (is_last_char) {
-                            suffix = " ";
-                        }
-
-                        fprintf(out, "%s%s%s%02x%s%s", color_start, prefix, color_end, data_source[this_byte - address], suffix, suffix_reset);
-                        prev_differs = differs;
-                    } else {
-                        if (prev_differs) {
-                            fprintf(out, "]%s", use_color ? ANSI_RESET : "");
-                            prev_differs = false;
-                        }
-                        fprintf(out, "   ");
-                    }
-                }
-                if (with_preview) {
-                    fprintf(out, "| ");
-                    for (auto this_byte = line_start; this_byte < line_start + line_lenght; ++this_byte) {
-                        auto in_area = this_byte >= address && this_byte < address + length;
-                        bool color = in_area && use_color && (shadow ? *this_byte != shadow[this_byte - address] : false);
-                        fprintf(out, "%s%c%s",
-                            color ? color_code : "",
-                            in_area ? get_preview_char(this_byte - address) : ' ',
-                            color ? ANSI_RESET : ""
-                        );
-                    }
-                }
-            };
+void StackShadow::add_signal_stack()
+{
+    stack_t alternate;
+    if (sigaltstack(nullptr, &alternate) == 0 && !(alternate.ss_flags & SS_DISABLE) && alternate.ss_size) {
+        // known already (or overlapping one that is) otherwise
+        [[maybe_unused]] auto const added = add_stack(alternate.ss_sp, alternate.ss_size);
+    }
+}
 
-            // actual
-            if (area == StackShadow::DumpArea::both || area == StackShadow::DumpArea::actual) {
-                print_hex_section(address, ANSI_RED_BLINK, [&](size_t offset) {
-                    return isprint(address[offset]) ? address[offset] : '.';
-                });
-            }
-            if (area == StackShadow::DumpArea::both) {
-                fprintf(out, " |");
-            }
-            // shadow
-            if (area == StackShadow::DumpArea::both || area == StackShadow::DumpArea::shadow) {
-                print_hex_section(shadow, ANSI_GREEN_BLINK, [&](size_t offset) {
-                    return isprint(shadow[offset]) ? shadow[offset] : '.';
-                });
+bool StackShadow::remove_stack(Region* stack)
+{
+    if (stack == own_region || !stack->stack_frames.empty()) {
+        return false;
+    }
+    if (stack == region) {
+        switch_stack(nullptr);
+    }
+    auto const begin = reinterpret_cast<uintptr_t>(stack->orig.caddress());
+    for (auto cell = begin >> cell_shift; cell <= (begin + stack->orig.size() - 1) >> cell_shift; ++cell) {
+        auto const [known, end] = cells.equal_range(cell);
+        for (auto it = known; it != end; ++it) {
+            if (it->second == stack) {
+                cells.erase(it);
+                break;
             }
-            fprintf(out, "%s\n", with_preview ? " |" : "");
         }
-        if (hidden_bytes || hidden_lines) {
-            fprintf(out, "    (%d equal bytes in %d lines hidden)\n", hidden_bytes, hidden_lines);
-            hidden_bytes = hidden_lines = 0;
+    }
+    for (auto const& other : regions) {
+        if (other->entered_from == stack) {
+            other->entered_from = nullptr;
         }
     }
-};
+    auto const index = stack->index;
+    std::swap(regions[index], regions.back());
+    regions[index]->index = index;
+    regions.pop_back();
+    return true;
+}
 
-void StackShadow::check(Direction direction)
+void StackShadow::switch_stack(Region* stack)
 {
-    size_t last_position = orig.position(orig.cend());
-    if (!stack_frames.empty()) {
-        last_position = stack_frames.back().position;
+    if (stack == nullptr) {
+        stack = own_region;
     }
-
-    auto ot = orig.caddress(last_position);
-    auto ob = orig.cend();
-    auto st = caddress(last_position);
-    auto depth = ob - ot;
-
-    if (memcmp(ot, st, depth) == 0) {
-        // all is OK
+    if (stack == region) {
         return;
     }
-
-    auto reaction = desired_reaction();
-    if (reaction == Reaction::ignore) {
-        return;
+    region = stack;
+    verified.frames = SIZE_MAX;
+    if (region->mode != check_mode || region->has_copy != keep_copy) {
+        recapture(*region);
     }
-    if (reaction == Reaction::heal_and_continue) {
-        memcpy(const_cast<uint8_t*>(ot), st, depth);
-        return;
+    if (check_mode == CheckMode::watch) {
+        arm_watchpoints();
     }
+}
 
-    fprintf(stderr, "SHADOW STACK REPORT\n");
+bool StackShadow::find_stack(void const* stack_pointer)
+{
+    auto const address = reinterpret_cast<uintptr_t>(stack_pointer);
+    auto const [known, end] = cells.equal_range(address >> cell_shift);
+    for (auto it = known; it != end; ++it) {
+        auto const stack = it->second;
+        if (stack->orig.caddress(stack_pointer)) {
+            if (stack->stack_frames.empty()) {
+                stack->entered_from = region;
+            }
+            switch_stack(stack);
+            return true;
+        }
+    }
 
-    fprintf(stderr, "\nDuring %s:\n", direction == Direction::PreCall ? "PRE-CALL to" : "POST-RETURN from");
-    bool first = true;
-    for (auto frame = stack_frames.rbegin(); frame != stack_frames.rend(); ++frame) {
+    // nothing gets added here, this may well be a signal handler interrupting malloc()
+    static std::atomic_flag warned = ATOMIC_FLAG_INIT;
+    if (!warned.test_and_set()) {
         fprintf(stderr,
-                "  position %10zd, size %10zd, callee %16p = %s\n",
-                frame->position,
-                frame->size,
-                frame->callee,
-                callee_traits::name(const_cast<void*>(frame->callee)).c_str());
-        if (first) {
-            fprintf(stderr, "NEXT SHADOW FRAMES (recent first):\n");
-            first = false;
-        }
+                "shadow stack: guarded call on an unknown stack at %p, not checked (see shst_stack_register() and "
+                "shst_thread_attach())\n",
+                stack_pointer);
     }
+    return false;
+}
 
-    fprintf(stderr, "\n");
-    MemoryPrinter orig_dump(dump_width(), dump_hide_equal_lines(), dump_area(), should_use_color());
-    orig_dump.print_header();
+size_t StackShadow::check_end() const
+{
+    auto end = region->orig.size();
+    if (region->stack_frames.empty()) {
+        return end;
+    }
+    // rotation with no other limit checks just the newest frame in full
+    auto const frames = rotate_frames && !check_frames && !check_bytes ? 1 : check_frames;
+    if (frames && frames < region->stack_frames.size()) {
+        auto const& oldest_checked = region->stack_frames[region->stack_frames.size() - frames];
+        end = oldest_checked.position + oldest_checked.size;
+    }
+    if (check_bytes) {
+        end = std::min(end, region->stack_frames.back().position + check_bytes);
+    }
+    return end;
+}
 
-    for (auto frame = stack_frames.rbegin(); frame != stack_frames.rend(); ++frame) {
-        fprintf(stderr,
-                "above is frame of: %16p = %s\n",
-                frame->callee,
-                callee_traits::name(const_cast<void*>(frame->callee)).c_str());
-        orig_dump.dump(stderr, orig.caddress(frame->position), caddress(frame->position), frame->size);
+// Next chunk of `rotate_frames` frames lying below `end`, i.e. not covered by the check of the top of the stack.
+// Cursor walks from the oldest frame up and starts over, so each frame gets its turn within
+// ceil(frames below end / rotate_frames) checks.
+std::pair<size_t, size_t> StackShadow::rotation_range(size_t end)
+{
+    if (!rotate_frames) {
+        return {end, end};
+    }
+    // frames [0, top) lie below end
+    auto const& frames = region->stack_frames;
+    auto const top = static_cast<size_t>(
+            std::partition_point(frames.begin(), frames.end(), [&](StackFrame const& frame) {
+                return frame.position >= end;
+            }) -
+            frames.begin());
+    if (top == 0) {
+        return {end, end};
     }
+    if (region->rotation_cursor >= top) {
+        // stack got shallower meanwhile
+        region->rotation_cursor = 0;
+    }
+    auto const oldest = region->rotation_cursor;
+    auto const newest = std::min(region->rotation_cursor + rotate_frames, top) - 1;
+    region->rotation_cursor = newest + 1 < top ? newest + 1 : 0;
+    return {frames[newest].position, frames[oldest].position + frames[oldest].size};
+}
+
+// frames starting within [begin, end), newest first
+std::pair<StackShadow::FrameIterator, StackShadow::FrameIterator> StackShadow::frames_within(size_t begin, size_t end)
+{
+    auto& frames = region->stack_frames;
+    auto const first = std::partition_point(frames.rbegin(), frames.rend(), [&](StackFrame const& frame) {
+        return frame.position < begin;
+    });
+    auto const last = std::partition_point(first, frames.rend(), [&](StackFrame const& frame) {
+        return frame.position < end;
+    });
+    return {first, last};
+}
 
-    // fprintf(stderr, "ALL OF IT\n");
-    // orig_dump.dump(stderr, ot, st, depth);
+// findings are appended to diff_ranges / corrupted_frames
+void StackShadow::verify(size_t begin, size_t end)
+{
+    switch (check_mode) {
+        case CheckMode::fingerprint:
+            fingerprints_match(begin, end);
+            break;
+        case CheckMode::return_address:
+            saved_words_match(begin, end);
+            break;
+        default:
+            compare(region->orig.caddress(begin), caddress(begin), end - begin, diff_ranges, begin);
+            break;
+    }
+}
 
-    auto print_enhanced_backtrace = []() {
-        fprintf(stderr, "\nbacktrace:\n");
-        std::array<void*, 1024> buff;
-        auto n = backtrace(buff.data(), buff.size());
+void StackShadow::fingerprints_match(size_t begin, size_t end)
+{
+    auto const [first, last] = frames_within(begin, end);
+    for (auto frame = first; frame != last; ++frame) {
+        if (fingerprint(region->orig.caddress(frame->position), frame->size) != frame->fingerprint) {
+            corrupted_frames.push_back(&*frame);
+        }
+    }
+}
 
-        // Try libunwind if backtrace() failed (common on musl)
-        if (n == 0) {
-#ifdef HAVE_LIBUNWIND
-            fprintf(stderr, "backtrace() failed, trying libunwind...\n");
+// diverged words go to diff_ranges, so positions come out ascending just like from compare()
+void StackShadow::saved_words_match(size_t begin, size_t end)
+{
+    auto const base = region->orig.caddress();
+    auto const [first, last] = frames_within(begin, end);
+    for (auto frame = first; frame != last; ++frame) {
+        bool frame_corrupted = false;
+        for (auto word = frame->first_word; word != frame->first_word + frame->words; ++word) {
+            auto const& saved = region->saved_words[word];
+            void* actual;
+            memcpy(&actual, base + saved.position, sizeof(actual));
+            if (actual != saved.value) {
+                diff_ranges.push_back({saved.position, sizeof(saved.value)});
+                frame_corrupted = true;
+            }
+        }
+        if (frame_corrupted) {
+            corrupted_frames.push_back(&*frame);
+        }
+    }
+}
 
-            unw_cursor_t cursor;
-            unw_context_t context;
+// what the frame should look like, as far as return address mode knows: actual content with saved words on top
+void StackShadow::expected_frame(StackFrame const& frame, std::vector<uint8_t>& buffer) const
+{
+    auto const begin = region->orig.caddress(frame.position);
+    buffer.assign(begin, begin + frame.size);
+    for (auto word = frame.first_word; word != frame.first_word + frame.words; ++word) {
+        auto const& saved = region->saved_words[word];
+        memcpy(buffer.data() + (saved.position - frame.position), &saved.value, sizeof(saved.value));
+    }
+}
 
-            int ret = unw_getcontext(&context);
-            if (ret < 0) {
-                fprintf(stderr, "ERROR: unw_getcontext() failed: %d\n", ret);
-                return;
+// whatever the last check found
+void StackShadow::heal()
+{
+    if (check_mode == CheckMode::return_address) {
+        for (auto frame : corrupted_frames) {
+            for (auto word = frame->first_word; word != frame->first_word + frame->words; ++word) {
+                auto const& saved = region->saved_words[word];
+                memcpy(const_cast<uint8_t*>(region->orig.caddress(saved.position)), &saved.value, sizeof(saved.value));
             }
+        }
+        return;
+    }
+    if (!keep_copy) {
+        // nothing to heal from
+        return;
+    }
+    if (check_mode == CheckMode::fingerprint) {
+        for (auto frame : corrupted_frames) {
+            auto const orig_frame = const_cast<uint8_t*>(region->orig.caddress(frame->position));
+            memcpy(orig_frame, caddress(frame->position), frame->size);
+        }
+        return;
+    }
+    for (auto const& range : diff_ranges) {
+        memcpy(const_cast<uint8_t*>(region->orig.caddress(range.offset)), caddress(range.offset), range.length);
+    }
+}
 
-            ret = unw_init_local(&cursor, &context);
-            if (ret < 0) {
-                fprintf(stderr, "ERROR: unw_init_local() failed: %d\n", ret);
-                return;
+// return addresses of the calling thread, backtrace() or libunwind when that fails (musl)
+int capture_backtrace(void** buffer, int capacity)
+{
+    auto n = backtrace(buffer, capacity);
+#ifdef HAVE_LIBUNWIND
+    if (n == 0) {
+        unw_context_t context;
+        unw_cursor_t cursor;
+        if (unw_getcontext(&context) < 0 || unw_init_local(&cursor, &context) < 0) {
+            return 0;
+        }
+        do {
+            unw_word_t ip;
+            if (unw_get_reg(&cursor, UNW_REG_IP, &ip) < 0) {
+                break;
             }
+            buffer[n++] = reinterpret_cast<void*>(ip);
+        } while (n < capacity && unw_step(&cursor) > 0);
+    }
+#endif
+    return n;
+}
 
-            int frame = 0;
-            do {
-                unw_word_t ip;
-                ret = unw_get_reg(&cursor, UNW_REG_IP, &ip);
-                if (ret < 0) {
-                    fprintf(stderr, "ERROR: unw_get_reg() failed: %d\n", ret);
-                    break;
-                }
+uint64_t address_of(void const* pointer)
+{
+    return reinterpret_cast<uintptr_t>(pointer);
+}
 
-                // Try to get symbol name
-                char symbol[256];
-                unw_word_t offset;
-                ret = unw_get_proc_name(&cursor, symbol, sizeof(symbol), &offset);
-
-                if (ret == 0) {
-                    fprintf(stderr, "Frame %2d: 0x%016lx in %s+0x%lx\n",
-                           frame, (unsigned long)ip, symbol, (unsigned long)offset);
-                } else {
-                    fprintf(stderr, "Frame %2d: 0x%016lx in <unknown>\n",
-                           frame, (unsigned long)ip);
-                }
+// Queues the record when SHST_REPORT_FILE is set, prints it right away otherwise. `encode` gets called twice, see
+// ReportEncoder. A queued record gets written before the process aborts.
+template <class Encode>
+void submit_report(Encode&& encode, bool aborting)
+{
+    ReportEncoder counter;
+    encode(counter, 0);
+    if (auto const writer = ReportWriter::instance()) {
+        auto const ticket = writer->reserve(counter.size());
+        if (ticket.record) {
+            ReportEncoder encoder{ticket.record};
+            encode(encoder, counter.size());
+            writer->commit(ticket);
+            if (aborting) {
+                writer->flush(ticket);
+            }
+        }
+        return;
+    }
+    std::vector<uint8_t> record(counter.size());
+    ReportEncoder encoder{record.data()};
+    encode(encoder, record.size());
+    auto const named = complete(record.data(), record.size());
+    Report report;
+    if (decode(named.data(), named.size(), report)) {
+        render(report, render_options(*report.header, STDERR_FILENO), stderr);
+    }
+}
 
-                frame++;
-                if (frame > 20) {  // Prevent infinite loops
-                    fprintf(stderr, "... (truncated, too many frames)\n");
-                    break;
-                }
+ReportHeader StackShadow::report_header(ReportKind kind)
+{
+    ReportHeader header{};
+    header.magic = report_magic;
+    header.kind = kind;
+    header.check_mode = check_mode;
+    header.flags = (keep_copy ? uint32_t{report_keep_copy} : 0) |
+                   (config().symbolize_offline ? uint32_t{report_offline} : 0);
+    header.dump_width = dump_width();
+    header.dump_area = dump_area();
+    header.dump_hide_equal = dump_hide_equal_lines();
+    header.dump_color = config().dump_color;
+    header.stack = address_of(region->orig.caddress());
+    header.thread = syscall(SYS_gettid);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.time = now.tv_sec * uint64_t{1000000000} + now.tv_nsec;
+    return header;
+}
 
-            } while ((ret = unw_step(&cursor)) > 0);
+void StackShadow::check(Direction direction)
+{
+    check(direction, region->stack_frames.empty() ? region->orig.size() : region->stack_frames.back().position);
+}
 
-            if (ret < 0) {
-                fprintf(stderr, "ERROR: unw_step() failed: %d\n", ret);
-            }
+void StackShadow::push_and_check(void* callee, void* stack_pointer)
+{
+    if (!fused_push_check) {
+        push(callee, stack_pointer);
+        check(Direction::PreCall);
+        return;
+    }
+    auto begin = region->stack_frames.empty() ? region->orig.size() : region->stack_frames.back().position;
+    auto const covered = verified.frames == region->stack_frames.size() ? verified.end : 0;
+    push(callee, stack_pointer);
+    // the new frame has just been copied from the stack, reading it again could not find anything: verification
+    // starts at the previous top (or where the last check left off)
+    if (covered > begin && region->stack_frames.back().sampled) {
+        begin = covered;
+        ++stats.elided_checks;
+    }
+    check(Direction::PreCall, begin);
+}
 
-            fprintf(stderr, "Total frames: %d\n", frame);
-#else
-            fprintf(stderr, "backtrace() failed and libunwind not available\n");
-#endif
-        } else {
-            // backtrace() worked, use it
-            backtrace_symbols_fd(buff.data(), n, 2);
+void StackShadow::check(Direction direction, size_t begin)
+{
+    if (pending_watch_hits) {
+        handle_watch_hits();
+    }
+    verified.frames = SIZE_MAX;
+    if (!region->stack_frames.empty() && !region->stack_frames.back().sampled) {
+        ++stats.skipped_checks;
+        return;
+    }
+    ++stats.sampled_checks;
+    if (check_mode == CheckMode::watch) {
+        // writes to watched return addresses are caught as they happen, see watch_hit()
+        return;
+    }
+
+    auto const suspension = direction == Direction::Suspension;
+    auto const end = suspension ? begin + region->stack_frames.back().size : check_end();
+    auto const [rotated_begin, rotated_end] = suspension ? std::pair{end, end} : rotation_range(end);
+
+    diff_ranges.clear();
+    corrupted_frames.clear();
+    if (begin < end) {
+        verify(begin, end);
+    }
+    if (rotated_begin != rotated_end) {
+        verify(rotated_begin, rotated_end);
+    }
+    if (diff_ranges.empty() && corrupted_frames.empty()) {
+        // all is OK
+        if (direction == Direction::PostReturn) {
+            // the frame is about to be popped
+            verified = {region->stack_frames.size() - 1, end};
         }
-    };
+        return;
+    }
+    ++stats.failed_checks;
 
-    print_enhanced_backtrace();
+    auto reaction = desired_reaction();
+    if (reaction == Reaction::ignore) {
+        return;
+    }
+    if (reaction == Reaction::heal_and_continue) {
+        heal();
+        return;
+    }
+
+    report(direction, reaction == Reaction::report_and_abort);
 
     switch (reaction) {
         case Reaction::report_and_continue:
-            // no-op, report already printed
+            // no-op, report already made
             break;
         case Reaction::report_heal_and_continue:
-            memcpy(const_cast<uint8_t*>(ot), st, depth);
+            heal();
             break;
         case Reaction::ignore:
         case Reaction::heal_and_continue:
@@ -587,38 +1057,529 @@ void StackShadow::check(Direction direction)
     }
 }
 
+ReportLimiter::Site StackShadow::check_site(Direction direction) const
+{
+    auto const& frames = region->stack_frames;
+    auto const callee = frames.empty() ? nullptr : frames.back().callee;
+    auto const position = frames.empty() ? region->orig.size() : frames.back().position;
+    auto key = ReportLimiter::mix(address_of(callee), position);
+    key = ReportLimiter::mix(key, static_cast<uint64_t>(direction) << 32 | region->index);
+    for (auto frame : corrupted_frames) {
+        key = ReportLimiter::mix(key, frame->position);
+    }
+    // the first few are enough to tell one corruption from another
+    for (size_t i = 0; i < std::min<size_t>(diff_ranges.size(), 16); ++i) {
+        key = ReportLimiter::mix(ReportLimiter::mix(key, diff_ranges[i].offset), diff_ranges[i].length);
+    }
+    return {key, callee, position};
+}
+
+bool StackShadow::admit_report(ReportLimiter::Site const& site, bool aborting)
+{
+    auto const admitted = aborting || limiter.admit(site, config().report_limit);
+    if (!admitted) {
+        ++stats.suppressed_reports;
+    }
+    report_summary(false);
+    return admitted;
+}
+
+void StackShadow::report_summary(bool final)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    auto const pending = limiter.take_pending(now.tv_sec * uint64_t{1000000000} + now.tv_nsec,
+                                              final ? 0 : config().report_summary_ns);
+    if (pending.empty()) {
+        return;
+    }
+    auto header = report_header(ReportKind::summary);
+    header.frames = pending.size();
+    std::vector<ReportFrame> frames;
+    std::vector<ReportSuppressed> counts;
+    for (auto const& site : pending) {
+        frames.push_back({address_of(site.site.callee), site.site.position, 0});
+        counts.push_back({site.suppressed, site.total});
+    }
+    submit_report(
+            [&](ReportEncoder& encoder, size_t size) {
+                header.size = size;
+                encoder.put(&header, 1);
+                encoder.put(frames.data(), frames.size());
+                encoder.put(counts.data(), counts.size());
+            },
+            false);
+}
+
+void StackShadow::report(Direction direction, bool aborting)
+{
+    if (!admit_report(check_site(direction), aborting)) {
+        return;
+    }
+    auto const& stack_frames = region->stack_frames;
+    auto header = report_header(ReportKind::check);
+    header.direction = direction == Direction::PreCall      ? ReportDirection::pre_call
+                       : direction == Direction::PostReturn ? ReportDirection::post_return
+                                                            : ReportDirection::suspension;
+
+    // newest first, as shown
+    std::vector<ReportFrame> frames;
+    for (auto frame = stack_frames.rbegin(); frame != stack_frames.rend(); ++frame) {
+        frames.push_back({address_of(frame->callee), frame->position, frame->size});
+    }
+    auto const index_of = [&](StackFrame const* frame) -> uint64_t {
+        return &stack_frames.back() - frame;
+    };
+    std::vector<uint64_t> corrupted;
+    for (auto frame : corrupted_frames) {
+        corrupted.push_back(index_of(frame));
+    }
+
+    std::vector<ReportWord> words;
+    if (check_mode == CheckMode::return_address) {
+        for (auto frame : corrupted_frames) {
+            for (auto word = frame->first_word; word != frame->first_word + frame->words; ++word) {
+                auto const& saved = region->saved_words[word];
+                void* actual;
+                memcpy(&actual, region->orig.caddress(saved.position), sizeof(actual));
+                if (actual == saved.value) {
+                    continue;
+                }
+                words.push_back({saved.position,
+                                 (word - frame->first_word) % 2,
+                                 address_of(actual),
+                                 address_of(saved.value),
+                                 address_of(frame->callee)});
+            }
+        }
+    }
+
+    // the report shows all frames, with a copy differences can be located in whatever the check did not cover
+    DiffRanges all_ranges;
+    if (keep_copy) {
+        auto const last_position = stack_frames.empty() ? region->orig.size() : stack_frames.back().position;
+        compare(region->orig.caddress(last_position),
+                caddress(last_position),
+                region->orig.size() - last_position,
+                all_ranges,
+                last_position);
+    }
+    auto const& ranges = keep_copy ? all_ranges : diff_ranges;
+
+    // without a shadow copy only the corrupted frames are worth showing
+    std::vector<uint64_t> shown;
+    for (auto frame = stack_frames.rbegin(); frame != stack_frames.rend(); ++frame) {
+        if (keep_copy ||
+            std::find(corrupted_frames.begin(), corrupted_frames.end(), &*frame) != corrupted_frames.end()) {
+            shown.push_back(index_of(&*frame));
+        }
+    }
+    // return address mode has no copy, but knows enough to reconstruct what corrupted frames should look like
+    auto const with_shadow = keep_copy || check_mode == CheckMode::return_address;
+    if (with_shadow) {
+        header.flags |= report_with_shadow;
+    }
+
+    std::array<void*, 1024> trace;
+    auto const depth = capture_backtrace(trace.data(), trace.size());
+
+    header.frames = frames.size();
+    header.corrupted = corrupted.size();
+    header.words = words.size();
+    header.ranges = ranges.size();
+    header.shown = shown.size();
+    header.backtrace = depth;
+
+    std::vector<uint8_t> expected;
+    submit_report(
+            [&](ReportEncoder& encoder, size_t size) {
+                header.size = size;
+                encoder.put(&header, 1);
+                encoder.put(frames.data(), frames.size());
+                encoder.put(corrupted.data(), corrupted.size());
+                encoder.put(words.data(), words.size());
+                encoder.put(ranges.data(), ranges.size());
+                encoder.put(shown.data(), shown.size());
+                for (auto index : shown) {
+                    auto const& frame = stack_frames[stack_frames.size() - 1 - index];
+                    encoder.put_bytes(region->orig.caddress(frame.position), frame.size);
+                    if (check_mode == CheckMode::return_address) {
+                        expected_frame(frame, expected);
+                        encoder.put_bytes(expected.data(), frame.size);
+                    } else if (keep_copy) {
+                        encoder.put_bytes(caddress(frame.position), frame.size);
+                    }
+                }
+                encoder.put(trace.data(), depth);
+            },
+            aborting);
+}
+
+void StackShadow::watch_hit(void const* address, void const* next_instruction)
+{
+    auto const& frames = region->stack_frames;
+    auto const frame = std::find_if(frames.rbegin(), frames.rend(), [&](StackFrame const& frame) {
+        return frame.return_slot == address;
+    });
+    if (frame == frames.rend() || pending_watch_hits == watch_hits.size()) {
+        // slot got re-armed meanwhile
+        return;
+    }
+    // further writes are of no interest until this one is handled
+    watchpoints.watch((frames.rend() - frame - 1) % Watchpoints::capacity, nullptr);
+    watch_hits[pending_watch_hits] = {frame->return_slot, *frame->return_slot, next_instruction};
+    std::atomic_signal_fence(std::memory_order_release);
+    pending_watch_hits = pending_watch_hits + 1;
+}
+
+// Before the corrupted return address gets used: the hit was in code running within the newest frame, its return
+// addresses are used only once that frame has been left.
+void StackShadow::handle_watch_hits()
+{
+    std::atomic_signal_fence(std::memory_order_acquire);
+    auto const reaction = desired_reaction();
+    for (size_t i = 0; i < pending_watch_hits; ++i) {
+        auto const hit = watch_hits[i];
+        auto const& frames = region->stack_frames;
+        auto const frame = std::find_if(frames.rbegin(), frames.rend(), [&](StackFrame const& frame) {
+            return frame.return_slot == hit.slot;
+        });
+        if (frame == frames.rend()) {
+            continue;
+        }
+        auto const slot = (frames.rend() - frame - 1) % Watchpoints::capacity;
+        if (reaction == Reaction::ignore) {
+            watchpoints.watch(slot, frame->return_slot);
+            continue;
+        }
+
+        // the unwinder would trip over the corrupted address, so the correct one is put back at least for the time
+        // of the report, the slot is not watched until then
+        auto const current = *frame->return_slot;
+        *frame->return_slot = frame->return_address;
+
+        auto site = ReportLimiter::mix(address_of(frame->callee), frame->position);
+        site = ReportLimiter::mix(ReportLimiter::mix(site, address_of(hit.corrupted)),
+                                  address_of(hit.next_instruction));
+        if (reaction != Reaction::heal_and_continue &&
+            admit_report({site, frame->callee, frame->position}, reaction == Reaction::report_and_abort)) {
+            auto header = report_header(ReportKind::watch_hit);
+            header.frames = 1;
+            ReportFrame const reported{address_of(frame->callee), frame->position, frame->size};
+            ReportWatch const watch{address_of(frame->return_address),
+                                    address_of(frame->return_slot),
+                                    address_of(hit.corrupted),
+                                    address_of(hit.next_instruction)};
+            std::array<void*, 1024> trace;
+            auto const depth = capture_backtrace(trace.data(), trace.size());
+            header.backtrace = depth;
+            submit_report(
+                    [&](ReportEncoder& encoder, size_t size) {
+                        header.size = size;
+                        encoder.put(&header, 1);
+                        encoder.put(&reported, 1);
+                        encoder.put(&watch, 1);
+                        encoder.put(trace.data(), depth);
+                    },
+                    reaction == Reaction::report_and_abort);
+        }
+
+        switch (reaction) {
+            case Reaction::report_and_continue:
+                *frame->return_slot = current;
+                break;
+            case Reaction::report_heal_and_continue:
+            case Reaction::heal_and_continue:
+                // already healed
+                break;
+            case Reaction::ignore:
+                break;
+            case Reaction::report_and_abort:
+            default:
+                abort();
+                break;
+        }
+        watchpoints.watch(slot, frame->return_slot);
+    }
+    pending_watch_hits = 0;
+}
+
 void StackShadow::pop()
 {
-    assert(!stack_frames.empty());
-    stack_frames.pop_back();
+    auto& frames = region->stack_frames;
+    assert(!frames.empty());
+    if (check_mode == CheckMode::return_address) {
+        region->saved_words.resize(frames.back().first_word);
+    } else if (check_mode == CheckMode::watch) {
+        // hand the slot back to the frame it was taken from
+        auto const index = frames.size() - 1;
+        auto const older = index >= Watchpoints::capacity ? frames[index - Watchpoints::capacity].return_slot : nullptr;
+        watchpoints.watch(index % Watchpoints::capacity, older);
+    }
+    frames.pop_back();
+    if (frames.empty() && region->entered_from) {
+        auto const back = region->entered_from;
+        region->entered_from = nullptr;
+        switch_stack(back);
+    }
 }
 
 class StackThreadContext
 {
   public:
-    StackThreadContext() = default;
-
-    void push(void* callee, void* stack_pointer);
-    void check(StackShadow::Direction direction);
-    void pop();
+    StackThreadContext();
+
+    void attach(void* stack_pointer);
+    // push + pre-call check, post-return check + pop, false when on an unknown stack
+    [[nodiscard]] bool enter(void* callee, void* stack_pointer);
+    void leave(void* stack_pointer);
+    // coroutines: push without checking older frames, check the newest frame only + pop
+    [[nodiscard]] bool resume(void* callee, void* stack_pointer);
+    void suspend(void* stack_pointer);
+
+    shst_stack* register_stack(void* begin, size_t size);
+    bool unregister_stack(shst_stack* stack);
+    void switch_stack(shst_stack* stack);
+
+    void set_check_depth(size_t frames);
+    void set_check_bytes(size_t bytes);
+    void set_check_rotate(size_t frames);
+    void set_sample_rate(uint32_t rate);
+    void set_fused_push_check(bool fused);
+    [[nodiscard]] shst_stats const& get_stats() const;
+    StackShadow::CheckMode set_check_mode(StackShadow::CheckMode mode);
+    void watch_hit(void const* address, void const* next_instruction);
+
+    void set_overhead_budget(double budget);
+    void get_governor_state(shst_governor_state& state) const;
 
   private:
+    // the governor works on top of what got configured by env / API
+    void apply_settings();
+    // takes over settings which changed since the `applied` snapshot
+    void apply_config(Config const& next);
+
+    void governed(uint64_t start)
+    {
+        auto const now = cycles();
+        if (governor.account(now - start, now)) {
+            apply_settings();
+        }
+    }
+
+    // Set while the thread runs code of the library. A signal handler interrupting it gets no shadow frame for its
+    // guarded calls rather than shadow stack state caught in the middle of an update (and malloc() maybe locked).
+    class Inside
+    {
+      public:
+        explicit Inside(bool volatile& flag)
+            : flag{flag}
+        {
+            flag = true;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+
+        ~Inside()
+        {
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            flag = false;
+        }
+
+      private:
+        bool volatile& flag;
+    };
+
+    Config const* applied;
     StackShadow shadow;
+    Governor governor;
+    Governor::Settings configured;
+    bool volatile inside = false;
 };
 
-void StackThreadContext::push(void* callee, void* stack_pointer)
+StackThreadContext::StackThreadContext()
+    : applied{&config()}
+    , shadow{*applied}
+    , governor{applied->overhead_budget}
+    , configured{shadow.check_depth(), shadow.sample_rate()}
 {
-    shadow.push(callee, stack_pointer);
 }
 
-void StackThreadContext::check(StackShadow::Direction direction)
+void StackThreadContext::attach(void* stack_pointer)
 {
-    shadow.check(direction);
+    Inside const scope{inside};
+    shadow.add_signal_stack();
+    if (shadow.use_stack(stack_pointer)) {
+        shadow.prepare(stack_pointer);
+    }
+}
+
+bool StackThreadContext::enter(void* callee, void* stack_pointer)
+{
+    if (inside) {
+        return false;
+    }
+    Inside const scope{inside};
+    if (auto const& current = config(); &current != applied) {
+        apply_config(current);
+    }
+    if (!shadow.use_stack(stack_pointer)) {
+        return false;
+    }
+    auto const start = governor.enabled() ? cycles() : 0;
+    shadow.push_and_check(callee, stack_pointer);
+    if (start) {
+        governed(start);
+    }
+    return true;
 }
 
-void StackThreadContext::pop()
+void StackThreadContext::leave(void* stack_pointer)
 {
+    Inside const scope{inside};
+    // entered on this very stack, so it is known
+    [[maybe_unused]] auto const known = shadow.use_stack(stack_pointer);
+    assert(known);
+    auto const start = governor.enabled() ? cycles() : 0;
+    shadow.check(StackShadow::Direction::PostReturn);
     shadow.pop();
+    if (start) {
+        governed(start);
+    }
+}
+
+bool StackThreadContext::resume(void* callee, void* stack_pointer)
+{
+    if (inside) {
+        return false;
+    }
+    Inside const scope{inside};
+    if (auto const& current = config(); &current != applied) {
+        apply_config(current);
+    }
+    if (!shadow.use_stack(stack_pointer)) {
+        return false;
+    }
+    auto const start = governor.enabled() ? cycles() : 0;
+    shadow.push(callee, stack_pointer);
+    if (start) {
+        governed(start);
+    }
+    return true;
+}
+
+void StackThreadContext::suspend(void* stack_pointer)
+{
+    Inside const scope{inside};
+    [[maybe_unused]] auto const known = shadow.use_stack(stack_pointer);
+    assert(known);
+    auto const start = governor.enabled() ? cycles() : 0;
+    shadow.check(StackShadow::Direction::Suspension);
+    shadow.pop();
+    if (start) {
+        governed(start);
+    }
+}
+
+shst_stack* StackThreadContext::register_stack(void* begin, size_t size)
+{
+    return reinterpret_cast<shst_stack*>(shadow.add_stack(begin, size));
+}
+
+bool StackThreadContext::unregister_stack(shst_stack* stack)
+{
+    return shadow.remove_stack(reinterpret_cast<StackShadow::Region*>(stack));
+}
+
+void StackThreadContext::switch_stack(shst_stack* stack)
+{
+    shadow.switch_stack(reinterpret_cast<StackShadow::Region*>(stack));
+}
+
+void StackThreadContext::apply_settings()
+{
+    auto const settings = governor.enabled() ? governor.settings(configured) : configured;
+    shadow.set_check_depth(settings.check_depth);
+    shadow.set_sample_rate(settings.sample_rate);
+}
+
+void StackThreadContext::apply_config(Config const& next)
+{
+    if (next.check_depth != applied->check_depth || next.sample_rate != applied->sample_rate) {
+        configured = {next.check_depth, next.sample_rate ? next.sample_rate : 1};
+        apply_settings();
+    }
+    if (next.check_bytes != applied->check_bytes) {
+        shadow.set_check_bytes(next.check_bytes);
+    }
+    if (next.check_rotate != applied->check_rotate) {
+        shadow.set_check_rotate(next.check_rotate);
+    }
+    if (next.check_mode != applied->check_mode || next.fingerprint_copy != applied->fingerprint_copy) {
+        shadow.set_check_mode(next.check_mode);
+    }
+    if (next.overhead_budget != applied->overhead_budget) {
+        governor.set_budget(next.overhead_budget);
+        apply_settings();
+    }
+    applied = &next;
+}
+
+void StackThreadContext::set_check_depth(size_t frames)
+{
+    configured.check_depth = frames;
+    apply_settings();
+}
+
+void StackThreadContext::set_check_bytes(size_t bytes)
+{
+    shadow.set_check_bytes(bytes);
+}
+
+void StackThreadContext::set_check_rotate(size_t frames)
+{
+    shadow.set_check_rotate(frames);
+}
+
+void StackThreadContext::set_fused_push_check(bool fused)
+{
+    shadow.set_fused_push_check(fused);
+}
+
+void StackThreadContext::set_sample_rate(uint32_t rate)
+{
+    configured.sample_rate = rate ? rate : 1;
+    apply_settings();
+}
+
+void StackThreadContext::set_overhead_budget(double budget)
+{
+    governor.set_budget(budget);
+    apply_settings();
+}
+
+void StackThreadContext::get_governor_state(shst_governor_state& state) const
+{
+    auto const settings = governor.enabled() ? governor.settings(configured) : configured;
+    state.budget = governor.budget();
+    state.overhead = governor.overhead();
+    state.level = governor.level();
+    state.check_depth = settings.check_depth;
+    state.sample_rate = settings.sample_rate;
+}
+
+shst_stats const& StackThreadContext::get_stats() const
+{
+    return shadow.get_stats();
+}
+
+StackShadow::CheckMode StackThreadContext::set_check_mode(StackShadow::CheckMode mode)
+{
+    return shadow.set_check_mode(mode);
+}
+
+void StackThreadContext::watch_hit(void const* address, void const* next_instruction)
+{
+    shadow.watch_hit(address, next_instruction);
 }
 
 StackThreadContext& getStackThreadContext()
@@ -627,29 +1588,139 @@ StackThreadContext& getStackThreadContext()
     return ctx;
 }
 
+// only threads with open watchpoints get here, so the context exists already
+void on_watch_hit(void const* address, void const* next_instruction)
+{
+    getStackThreadContext().watch_hit(address, next_instruction);
+}
+
 namespace detail {
 
-guard::guard(void* callee, void* stack_pointer)
+bool enter(void* callee, void* stack_pointer)
+{
+    return getStackThreadContext().enter(callee, stack_pointer);
+}
+
+void leave(void* stack_pointer)
 {
-    StackThreadContext& ctx = getStackThreadContext();
-    ctx.push(callee, stack_pointer);
-    ctx.check(StackShadow::Direction::PreCall);
+    getStackThreadContext().leave(stack_pointer);
 }
 
-guard::~guard()
+bool resume(void* callee, void* stack_pointer)
 {
-    StackThreadContext& ctx = getStackThreadContext();
-    ctx.check(StackShadow::Direction::PostReturn);
-    ctx.pop();
+    return getStackThreadContext().resume(callee, stack_pointer);
+}
+
+void suspend(void* stack_pointer)
+{
+    getStackThreadContext().suspend(stack_pointer);
+}
+
+void set_fused_push_check(bool fused)
+{
+    getStackThreadContext().set_fused_push_check(fused);
 }
 
 } // namespace detail
 } // namespace shst
 
-extern "C" void*
-shst_invoke_impl(void* callee, void* x0, void* x1, void* x2, void* x3, void* x4, void* x5, void* x6, void* x7)
+extern "C" void* shst_invoke_impl(void* callee, ...)
 {
+    void* x[8];
+    va_list args;
+    va_start(args, callee);
+    for (auto& x_i : x) {
+        x_i = va_arg(args, void*);
+    }
+    va_end(args);
     long stack_position;
     shst::detail::guard g{callee, &stack_position};
-    return reinterpret_cast<shst_f>(callee)(x0, x1, x2, x3, x4, x5, x6, x7);
+    return reinterpret_cast<shst_f>(callee)(x[0], x[1], x[2], x[3], x[4], x[5], x[6], x[7]);
+}
+
+extern "C" void shst_thread_attach(void)
+{
+    long stack_position;
+    shst::getStackThreadContext().attach(&stack_position);
+}
+
+extern "C" shst_stack* shst_stack_register(void* begin, size_t size)
+{
+    return shst::getStackThreadContext().register_stack(begin, size);
+}
+
+extern "C" int shst_stack_unregister(shst_stack* stack)
+{
+    return shst::getStackThreadContext().unregister_stack(stack) ? 0 : -1;
+}
+
+extern "C" void shst_stack_switch(shst_stack* stack)
+{
+    shst::getStackThreadContext().switch_stack(stack);
+}
+
+extern "C" void shst_set_enabled(int enabled)
+{
+    shst::detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+extern "C" int shst_attach_library(char const* library, char const* pattern, size_t stack_bytes, int flags)
+{
+    return shst::attach_library(library, pattern, stack_bytes, (flags & SHST_ATTACH_GOT) != 0);
+}
+
+extern "C" int shst_detach_library(char const* library)
+{
+    return shst::detach_library(library);
+}
+
+extern "C" void shst_reload_config(void)
+{
+    shst::reload_config();
+}
+
+extern "C" void shst_set_shadow_pool_enabled(int enabled)
+{
+    shst::set_shadow_pool_enabled(enabled);
+}
+
+extern "C" void shst_set_check_depth(size_t frames)
+{
+    shst::getStackThreadContext().set_check_depth(frames);
+}
+
+extern "C" void shst_set_check_bytes(size_t bytes)
+{
+    shst::getStackThreadContext().set_check_bytes(bytes);
+}
+
+extern "C" void shst_set_check_rotate(size_t frames)
+{
+    shst::getStackThreadContext().set_check_rotate(frames);
+}
+
+extern "C" shst_check_mode shst_set_check_mode(shst_check_mode mode)
+{
+    return static_cast<shst_check_mode>(
+            shst::getStackThreadContext().set_check_mode(static_cast<shst::StackShadow::CheckMode>(mode)));
+}
+
+extern "C" void shst_set_sample_rate(unsigned rate)
+{
+    shst::getStackThreadContext().set_sample_rate(rate);
+}
+
+extern "C" void shst_get_thread_stats(shst_stats* stats)
+{
+    *stats = shst::getStackThreadContext().get_stats();
+}
+
+extern "C" void shst_set_overhead_budget(double budget)
+{
+    shst::getStackThreadContext().set_overhead_budget(budget);
+}
+
+extern "C" void shst_get_governor_state(shst_governor_state* state)
+{
+    shst::getStackThreadContext().get_governor_state(*state);
 }
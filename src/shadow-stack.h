@@ -1,6 +1,7 @@
 #pragma once
 
 #include "shadow-stack-common.h"
+#include <stddef.h>
 
 #ifdef __cplusplus
 #define MAYBE_EXTERN_C extern "C"
@@ -8,7 +9,147 @@
 #define MAYBE_EXTERN_C
 #endif
 
+// Guarded call of `callee` with up to 8 pointer-sized arguments (the rest are taken for garbage and passed on), its
+// result taken for a pointer. What shst_invoke() comes down to where trampolines are not available.
 MAYBE_EXTERN_C
 void* shst_invoke_impl(void* callee, ...);
 
+// bytes of stack arguments shst_trampoline() passes through
+#define SHST_TRAMPOLINE_STACK_BYTES 64
 
+#if defined(__x86_64__)
+// Guards a call of a function of any signature: argument registers, the first 64 bytes of stack arguments and all
+// return values are passed through as they are. Not called directly, the callee goes in %r10 (the static chain
+// register) and the trampoline is called in its stead, as if it were the callee. shst_invoke() does it through
+// shst_trampoline_pointer (GCC passes the static chain to indirect calls only), SHST_TRAMPOLINE() makes a function of
+// its own for a callee. Vector arguments wider than 128 bits (__m256, __m512) are not passed through.
+MAYBE_EXTERN_C
+void shst_trampoline(void);
+
+// The same, with the number of bytes of stack arguments in %r11
+MAYBE_EXTERN_C
+void shst_trampoline_sized(void);
+
+#define SHST_STRINGIFY_(x) #x
+#define SHST_STRINGIFY(x) SHST_STRINGIFY_(x)
+
+// Defines function `name` (at file scope), a guarded call of `target` with the same signature: declare it like the
+// target and call it instead. Both are symbol names, C linkage. Stack arguments over SHST_TRAMPOLINE_STACK_BYTES (many
+// arguments, large structs passed by value) need SHST_TRAMPOLINE_STACK(). The jump goes through the GOT, lazy binding
+// of a PLT entry would clobber %r10 and %r11.
+#define SHST_TRAMPOLINE(name, target) SHST_TRAMPOLINE_STACK(name, target, SHST_TRAMPOLINE_STACK_BYTES)
+
+#define SHST_TRAMPOLINE_STACK(name, target, stack_bytes)                                                      \
+    SHST_TRAMPOLINE_DEFINE(name, "mov " #target "@GOTPCREL(%rip), %r10\n", stack_bytes)
+
+// The same, calling whatever table[index] points to at the time: `table` is an array of function pointers, defined
+// with hidden visibility in the same object (the way a generated preload library keeps its resolved targets).
+#define SHST_TRAMPOLINE_SLOT(name, table, index, stack_bytes)                                                 \
+    SHST_TRAMPOLINE_DEFINE(name, "mov " #table "+8*" SHST_STRINGIFY(index) "(%rip), %r10\n", stack_bytes)
+
+#define SHST_TRAMPOLINE_DEFINE(name, load_callee, stack_bytes)                                                \
+    __asm__(".pushsection .text\n"                                                                             \
+            ".globl " #name "\n"                                                                               \
+            ".type " #name ", @function\n"                                                                     \
+            ".p2align 4\n" #name ":\n"                                                                         \
+            ".cfi_startproc\n" load_callee "mov $" SHST_STRINGIFY(stack_bytes) ", %r11d\n"                     \
+            "jmp *shst_trampoline_sized@GOTPCREL(%rip)\n"                                                      \
+            ".cfi_endproc\n"                                                                                   \
+            ".size " #name ", . - " #name "\n"                                                                 \
+            ".popsection\n")
+#endif
+
+// shst_attach_library() flags: PLT entries only, function addresses are left alone
+#define SHST_ATTACH_PLT 0
+// GOT entries of functions too, which code built with -fno-plt calls through, as does code of an object that also
+// takes the address of the function. Taking the address reads them as well: while attached it gives the trampoline,
+// which compares unequal to the address the library itself hands out, and a pointer stored meanwhile keeps going
+// through the guard after detaching.
+#define SHST_ATTACH_GOT 1
+
+// Guard calls into a shared library already loaded, no restart and no LD_PRELOAD: the PLT entries (see `flags`) other
+// loaded objects call functions of `library` (its file name like "libfoo.so", or path) through, those with names
+// matching `pattern` (fnmatch(), NULL for all), get redirected to trampolines. Calls pass up to `stack_bytes` of stack
+// arguments through, SHST_TRAMPOLINE_STACK_BYTES is enough unless a function takes many arguments or large structs by
+// value. Returns how many, -1 when the library isn't loaded or without trampolines (x86-64 only). Detach it before
+// dlclose(), and don't attach libraries the shadow stack itself runs on (libc, libstdc++).
+MAYBE_EXTERN_C
+int shst_attach_library(char const* library, char const* pattern, size_t stack_bytes, int flags);
+
+// Put back the GOT entries shst_attach_library() redirected, calls of the library cost nothing extra again. Returns
+// how many.
+MAYBE_EXTERN_C
+int shst_detach_library(char const* library);
+
+// Turn all checks on or off at once (see SHST_ENABLED), a disabled guard costs a single load and branch. Calls
+// in progress keep their shadow frames until they return.
+MAYBE_EXTERN_C
+void shst_set_enabled(int enabled);
+
+// Parse SHST_* environment variables (and SHST_CONFIG_FILE) again, see SHST_RELOAD_SIGNAL. Every thread picks up
+// changed check settings on its next guarded call, overriding what the per-thread API set before. Also sets the
+// enable flag.
+MAYBE_EXTERN_C
+void shst_reload_config(void);
+
+// Set up shadow stack of the calling thread (stack bounds, shadow memory for the top of the stack) right away
+// rather than on its first guarded call, best called as the thread starts. The shst-thread-attach library does
+// it for every thread created with pthread_create() and for the main thread. Registers the alternate signal stack of
+// the thread too, call it (again) after sigaltstack() to have guarded calls of signal handlers running there checked.
+MAYBE_EXTERN_C
+void shst_thread_attach(void);
+
+// Make [begin, begin + size) a known stack of the calling thread, with shadow frames of its own: fibers,
+// makecontext()/swapcontext() contexts etc. (or the alternate signal stack, see shst_thread_attach()). Guarded calls
+// on stacks which are not known go unchecked. Returns NULL when the range overlaps a known stack.
+MAYBE_EXTERN_C
+shst_stack* shst_stack_register(void* begin, size_t size);
+
+// Forget a stack, fails (returns -1) while guarded calls on it are in progress
+MAYBE_EXTERN_C
+int shst_stack_unregister(shst_stack* stack);
+
+// Tell the calling thread it is about to run on `stack` (NULL for its own stack), e.g. right before swapcontext().
+// Optional, a guarded call finds its stack anyway, this only saves the lookup.
+MAYBE_EXTERN_C
+void shst_stack_switch(shst_stack* stack);
+
+// Recycle shadow memory of exited threads (enabled by default, see SHST_SHADOW_POOL)
+MAYBE_EXTERN_C
+void shst_set_shadow_pool_enabled(int enabled);
+
+// Limit checks of the calling thread to the most recent frames / bytes of the stack (see SHST_CHECK_DEPTH and
+// SHST_CHECK_BYTES), SHST_CHECK_FULL verifies everything down to the bottom of the stack
+#define SHST_CHECK_FULL 0
+
+MAYBE_EXTERN_C
+void shst_set_check_depth(size_t frames);
+
+MAYBE_EXTERN_C
+void shst_set_check_bytes(size_t bytes);
+
+// Verify also `frames` deeper frames per check, taking turns so the whole stack gets covered every
+// ceil(depth / frames) checks (see SHST_CHECK_ROTATE), 0 turns rotation off
+MAYBE_EXTERN_C
+void shst_set_check_rotate(size_t frames);
+
+// Change how stack of the calling thread is verified, frames already on the stack are re-captured as they are.
+// Returns the mode in effect, SHST_CHECK_WATCH falls back to SHST_CHECK_EXACT without hardware watchpoints.
+MAYBE_EXTERN_C
+shst_check_mode shst_set_check_mode(shst_check_mode mode);
+
+// Check only a sample of guarded calls of the calling thread, the first `rate` calls of every callee and then
+// every `rate`-th one (see SHST_SAMPLE_RATE), 1 checks every call
+MAYBE_EXTERN_C
+void shst_set_sample_rate(unsigned rate);
+
+MAYBE_EXTERN_C
+void shst_get_thread_stats(shst_stats* stats);
+
+// Keep time spent in the shadow stack by the calling thread under `budget` (fraction of wall time, e.g. 0.03) by
+// trading check depth and sample rate for speed (see SHST_OVERHEAD_BUDGET), 0 turns the governor off
+MAYBE_EXTERN_C
+void shst_set_overhead_budget(double budget);
+
+MAYBE_EXTERN_C
+void shst_get_governor_state(shst_governor_state* state);
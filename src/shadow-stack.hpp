@@ -1,16 +1,43 @@
 #pragma once
 
 #include "callee_traits.hpp"
+#include <atomic>
 #include <type_traits>
 #include <functional>
 
 namespace shst {
 namespace detail {
 
+// global kill switch, see SHST_ENABLED and shst_set_enabled()
+extern std::atomic<bool> enabled;
+
+// false when nothing got pushed (unknown stack)
+bool enter(void* callee, void* stack_pointer);
+void leave(void* stack_pointer);
+// frame of a coroutine, see shadow-stack-coro.hpp
+bool resume(void* callee, void* stack_pointer);
+void suspend(void* stack_pointer);
+// guard-bench only: false makes the pre-call check of this thread read the new frame again after pushing it, the
+// way it worked before both got fused
+void set_fused_push_check(bool fused);
+
 struct guard
 {
-    guard(void* callee, void* stack_pointer);
-    ~guard();
+    guard(void* callee, void* stack_pointer)
+        : active{enabled.load(std::memory_order_relaxed) && enter(callee, stack_pointer)}
+    {
+    }
+
+    ~guard()
+    {
+        // whatever the switch says by now, a pushed frame has to be popped
+        if (active) {
+            // the guard lives on the stack it was entered on
+            leave(this);
+        }
+    }
+
+    bool const active;
 };
 
 } // namespace detail
@@ -0,0 +1,263 @@
+#include "symbolizer.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <set>
+#include <string>
+#include <vector>
+
+// Writes the C source of an LD_PRELOAD library which guards calls of the given functions (named, or all a shared
+// library exports). Every target is looked up once, by a constructor, into a flat table; a wrapper is a trampoline
+// loading its target from the table (see SHST_TRAMPOLINE_SLOT()), no lookups and no locks on the way. Until then a
+// slot points at a stub looking its target up on the first call, for constructors of other libraries which run
+// first. Build it as a shared library linked with shst and dl, see shst_add_preload_library() in
+// cmake/ShstPreload.cmake.
+
+namespace {
+
+void usage(FILE* out)
+{
+    fprintf(out,
+            "usage: shst-preload-gen [options] [SYMBOL]...\n"
+            "  -o, --output=FILE           write the source to FILE rather than stdout\n"
+            "  -l, --library=FILE          wrap every function the shared library FILE exports\n"
+            "  -x, --exclude=SYMBOL        don't wrap SYMBOL\n"
+            "  -s, --stack-bytes=N         bytes of stack arguments passed on, default 64\n");
+}
+
+// what the assembler takes for a symbol name without quoting
+bool plain_symbol(std::string const& name)
+{
+    return !name.empty() && !isdigit(static_cast<unsigned char>(name[0])) &&
+           std::all_of(name.begin(), name.end(), [](char c) {
+               return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$';
+           });
+}
+
+void generate(FILE* out, std::vector<std::string> const& symbols, unsigned long stack_bytes)
+{
+    fprintf(out,
+            "// Generated by shst-preload-gen, don't edit.\n"
+            "#include \"shadow-stack.h\"\n"
+            "#include <dlfcn.h>\n"
+            "#include <stdio.h>\n"
+            "#include <stdlib.h>\n"
+            "\n"
+            "#define SHST_PRELOAD_COUNT %zu\n"
+            "\n"
+            "static char const* const shst_preload_names[SHST_PRELOAD_COUNT] = {\n",
+            symbols.size());
+    for (auto const& symbol : symbols) {
+        fprintf(out, "    \"%s\",\n", symbol.c_str());
+    }
+    fputs("};\n"
+          "\n"
+          "#if defined(__x86_64__)\n"
+          "// Slot n starts out at stub n, which has its target looked up and goes on to it with whatever the caller\n"
+          "// passed, registers and stack as they were\n"
+          "__asm__(\".pushsection .text\\n\"\n"
+          "        \".p2align 4\\n\"\n"
+          "        \"shst_preload_lazy:\\n\"\n"
+          "        \".cfi_startproc\\n\"\n"
+          "        \"push %rbp\\n\"\n"
+          "        \".cfi_def_cfa_offset 16\\n\"\n"
+          "        \".cfi_offset %rbp, -16\\n\"\n"
+          "        \"mov %rsp, %rbp\\n\"\n"
+          "        \".cfi_def_cfa_register %rbp\\n\"\n"
+          "        \"sub $192, %rsp\\n\"\n"
+          "        \"mov %rdi, 0(%rsp)\\n\"\n"
+          "        \"mov %rsi, 8(%rsp)\\n\"\n"
+          "        \"mov %rdx, 16(%rsp)\\n\"\n"
+          "        \"mov %rcx, 24(%rsp)\\n\"\n"
+          "        \"mov %r8, 32(%rsp)\\n\"\n"
+          "        \"mov %r9, 40(%rsp)\\n\"\n"
+          "        \"mov %rax, 48(%rsp)\\n\"\n"
+          "        \"mov %r10, 56(%rsp)\\n\"\n"
+          "        \"movups %xmm0, 64(%rsp)\\n\"\n"
+          "        \"movups %xmm1, 80(%rsp)\\n\"\n"
+          "        \"movups %xmm2, 96(%rsp)\\n\"\n"
+          "        \"movups %xmm3, 112(%rsp)\\n\"\n"
+          "        \"movups %xmm4, 128(%rsp)\\n\"\n"
+          "        \"movups %xmm5, 144(%rsp)\\n\"\n"
+          "        \"movups %xmm6, 160(%rsp)\\n\"\n"
+          "        \"movups %xmm7, 176(%rsp)\\n\"\n"
+          "        \"mov %r11d, %edi\\n\"\n"
+          "        \"call shst_preload_resolve_slot\\n\"\n"
+          "        \"mov %rax, %r11\\n\"\n"
+          "        \"mov 0(%rsp), %rdi\\n\"\n"
+          "        \"mov 8(%rsp), %rsi\\n\"\n"
+          "        \"mov 16(%rsp), %rdx\\n\"\n"
+          "        \"mov 24(%rsp), %rcx\\n\"\n"
+          "        \"mov 32(%rsp), %r8\\n\"\n"
+          "        \"mov 40(%rsp), %r9\\n\"\n"
+          "        \"mov 48(%rsp), %rax\\n\"\n"
+          "        \"mov 56(%rsp), %r10\\n\"\n"
+          "        \"movups 64(%rsp), %xmm0\\n\"\n"
+          "        \"movups 80(%rsp), %xmm1\\n\"\n"
+          "        \"movups 96(%rsp), %xmm2\\n\"\n"
+          "        \"movups 112(%rsp), %xmm3\\n\"\n"
+          "        \"movups 128(%rsp), %xmm4\\n\"\n"
+          "        \"movups 144(%rsp), %xmm5\\n\"\n"
+          "        \"movups 160(%rsp), %xmm6\\n\"\n"
+          "        \"movups 176(%rsp), %xmm7\\n\"\n"
+          "        \"leave\\n\"\n"
+          "        \".cfi_def_cfa %rsp, 8\\n\"\n"
+          "        \"jmp *%r11\\n\"\n"
+          "        \".cfi_endproc\\n\"\n"
+          "        \".popsection\\n\");\n"
+          "\n"
+          "#define SHST_PRELOAD_LAZY(n)                                                                       \\\n"
+          "    __attribute__((visibility(\"hidden\"))) void shst_preload_lazy_##n(void);                        \\\n"
+          "    __asm__(\".pushsection .text\\n\"                                                                 \\\n"
+          "            \".p2align 4\\n\"                                                                         \\\n"
+          "            \"shst_preload_lazy_\" #n \":\\n\"                                                          \\\n"
+          "            \"mov $\" #n \", %r11d\\n\"                                                                 \\\n"
+          "            \"jmp shst_preload_lazy\\n\"                                                              \\\n"
+          "            \".popsection\\n\");\n",
+          out);
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        fprintf(out, "SHST_PRELOAD_LAZY(%zu)\n", i);
+    }
+    fputs("\n"
+          "// the functions wrapped, in the order of names\n"
+          "__attribute__((visibility(\"hidden\"))) void* shst_preload_targets[SHST_PRELOAD_COUNT] = {\n",
+          out);
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        fprintf(out, "    (void*)shst_preload_lazy_%zu,\n", i);
+    }
+    fputs("};\n"
+          "#else\n"
+          "// null until looked up, see SHST_PRELOAD_WRAPPER\n"
+          "__attribute__((visibility(\"hidden\"))) void* shst_preload_targets[SHST_PRELOAD_COUNT];\n"
+          "#endif\n"
+          "\n"
+          "static void shst_preload_unresolved(void)\n"
+          "{\n"
+          "    fputs(\"shadow stack preload: called a function which wasn't found\\n\", stderr);\n"
+          "    abort();\n"
+          "}\n"
+          "\n"
+          "__attribute__((visibility(\"hidden\"))) void* shst_preload_resolve_slot(int i)\n"
+          "{\n"
+          "    void* target = dlsym(RTLD_NEXT, shst_preload_names[i]);\n"
+          "    target = target ? target : (void*)shst_preload_unresolved;\n"
+          "    __atomic_store_n(&shst_preload_targets[i], target, __ATOMIC_RELEASE);\n"
+          "    return target;\n"
+          "}\n"
+          "\n"
+          "__attribute__((constructor)) static void shst_preload_resolve(void)\n"
+          "{\n"
+          "    for (int i = 0; i < SHST_PRELOAD_COUNT; ++i) {\n"
+          "        shst_preload_resolve_slot(i);\n"
+          "    }\n"
+          "}\n"
+          "\n"
+          "#if defined(__x86_64__)\n",
+          out);
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        fprintf(out, "SHST_TRAMPOLINE_SLOT(%s, shst_preload_targets, %zu, %lu);\n", symbols[i].c_str(), i, stack_bytes);
+    }
+    fprintf(out,
+            "#else\n"
+            "// pointer-sized arguments and result only, see shst_invoke_impl()\n"
+            "#define SHST_PRELOAD_WRAPPER(n, symbol)                                                            \\\n"
+            "    void* shst_preload_wrapper_##n(void* x0, void* x1, void* x2, void* x3, void* x4, void* x5,     \\\n"
+            "                                   void* x6, void* x7) __asm__(symbol);                            \\\n"
+            "    void* shst_preload_wrapper_##n(void* x0, void* x1, void* x2, void* x3, void* x4, void* x5,     \\\n"
+            "                                   void* x6, void* x7)                                             \\\n"
+            "    {                                                                                              \\\n"
+            "        void* target = __atomic_load_n(&shst_preload_targets[n], __ATOMIC_ACQUIRE);                \\\n"
+            "        target = target ? target : shst_preload_resolve_slot(n);                                   \\\n"
+            "        return shst_invoke_impl(target, x0, x1, x2, x3, x4, x5, x6, x7);                           \\\n"
+            "    }\n");
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        fprintf(out, "SHST_PRELOAD_WRAPPER(%zu, \"%s\")\n", i, symbols[i].c_str());
+    }
+    fprintf(out, "#endif\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    static option const options[]{{"output", required_argument, nullptr, 'o'},
+                                  {"library", required_argument, nullptr, 'l'},
+                                  {"exclude", required_argument, nullptr, 'x'},
+                                  {"stack-bytes", required_argument, nullptr, 's'},
+                                  {"help", no_argument, nullptr, 'h'},
+                                  {}};
+    char const* output = nullptr;
+    std::vector<std::string> symbols;
+    // every shared library has its own, they aren't for wrapping
+    std::set<std::string> excluded{"_init", "_fini"};
+    unsigned long stack_bytes = 64;
+    for (int option; (option = getopt_long(argc, argv, "o:l:x:s:h", options, nullptr)) != -1;) {
+        switch (option) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'l': {
+                auto exported = shst::exported_functions(optarg);
+                if (exported.empty()) {
+                    fprintf(stderr, "shst-preload-gen: no functions exported by %s\n", optarg);
+                    return 1;
+                }
+                symbols.insert(symbols.end(), exported.begin(), exported.end());
+                break;
+            }
+            case 'x':
+                excluded.insert(optarg);
+                break;
+            case 's': {
+                char* end;
+                stack_bytes = strtoul(optarg, &end, 0);
+                if (*end != '\0' || stack_bytes > 4096) {
+                    fprintf(stderr, "shst-preload-gen: bad stack size: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            }
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return 2;
+        }
+    }
+    symbols.insert(symbols.end(), argv + optind, argv + argc);
+    symbols.erase(std::remove_if(symbols.begin(),
+                                 symbols.end(),
+                                 [&](std::string const& symbol) { return excluded.count(symbol) != 0; }),
+                  symbols.end());
+    // aliases and repeated names get a single wrapper
+    std::sort(symbols.begin(), symbols.end());
+    symbols.erase(std::unique(symbols.begin(), symbols.end()), symbols.end());
+    if (symbols.empty()) {
+        usage(stderr);
+        return 2;
+    }
+    for (auto const& symbol : symbols) {
+        if (!plain_symbol(symbol)) {
+            fprintf(stderr, "shst-preload-gen: can't wrap %s\n", symbol.c_str());
+            return 1;
+        }
+    }
+
+    auto const out = output ? fopen(output, "w") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "shst-preload-gen: can't write %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    generate(out, symbols, stack_bytes);
+    if (fflush(out) != 0 || (output && fclose(out) != 0)) {
+        fprintf(stderr, "shst-preload-gen: can't write %s: %s\n", output ? output : "stdout", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "report.hpp"
+#include "symbolizer.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <getopt.h>
+#include <optional>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Prints reports written to SHST_REPORT_FILE the way they would have been printed to stderr, or lists them. Offline
+// records (SHST_SYMBOLIZE=offline) get named here, with symbols from debug files matching their build-ids.
+
+namespace {
+
+using namespace shst;
+
+struct Overrides
+{
+    std::optional<int> width;
+    std::optional<DumpArea> area;
+    std::optional<bool> hide_equal;
+    std::optional<DumpColor> color;
+    bool list = false;
+    // where gdb looks too
+    std::vector<std::string> debug_directories{"/usr/lib/debug"};
+};
+
+void usage(FILE* out)
+{
+    fprintf(out,
+            "usage: shst-report [options] FILE...\n"
+            "  -l, --list                  one line per report\n"
+            "  -w, --width=N               bytes per dump line\n"
+            "  -a, --area=both|actual|shadow\n"
+            "  -e, --hide-equal            hide equal dump lines\n"
+            "  -c, --color=auto|always|never\n"
+            "  -d, --debug-dir=DIR         look for debug files of offline reports in DIR too\n"
+            "Dump settings default to those of the reporting process (SHST_DUMP_*).\n");
+}
+
+void list(Report const& report, char const* file, size_t offset)
+{
+    auto const& header = *report.header;
+    auto const seconds = static_cast<time_t>(header.time / 1000000000);
+    tm local;
+    char when[32];
+    strftime(when, sizeof(when), "%F %T", localtime_r(&seconds, &local));
+    printf("%s:%zu: %s.%09llu thread %llu, %s, %u frames, %s\n",
+           file,
+           offset,
+           when,
+           static_cast<unsigned long long>(header.time % 1000000000),
+           static_cast<unsigned long long>(header.thread),
+           header.kind == ReportKind::watch_hit ? "watch hit"
+           : header.kind == ReportKind::summary ? "summary"
+                                                : "failed check",
+           header.frames,
+           header.frames ? name_of(report, report.frames[0].callee).c_str() : "?");
+}
+
+bool print(char const* file, Overrides const& overrides, OfflineSymbolizer& symbolizer)
+{
+    auto const fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "shst-report: can't open %s: %s\n", file, strerror(errno));
+        return false;
+    }
+    auto const size = static_cast<size_t>(st.st_size);
+    auto const data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    auto const bytes = static_cast<uint8_t const*>(data);
+    size_t offset = sizeof(report_file_magic) + 2 * sizeof(uint32_t);
+    if (data == MAP_FAILED || size < offset || memcmp(bytes, report_file_magic, sizeof(report_file_magic)) != 0) {
+        fprintf(stderr, "shst-report: %s is not a report file\n", file);
+        return false;
+    }
+
+    auto ok = true;
+    while (offset < size) {
+        Report report;
+        if (!decode(bytes + offset, size - offset, report)) {
+            fprintf(stderr, "shst-report: %s: broken record at offset %zu\n", file, offset);
+            ok = false;
+            break;
+        }
+        std::vector<uint8_t> named;
+        if (report.header->modules && !report.header->names) {
+            auto const& modules = report.modules;
+            named = add_names(bytes + offset, report.header->size, [&](uint64_t address, bool line) {
+                return symbolizer.name(modules, address, line);
+            });
+            if (!decode(named.data(), named.size(), report)) {
+                fprintf(stderr, "shst-report: %s: can't name record at offset %zu\n", file, offset);
+                ok = false;
+                break;
+            }
+        }
+        if (overrides.list) {
+            list(report, file, offset);
+        } else {
+            auto options = render_options(*report.header, STDOUT_FILENO);
+            options.dump_width = overrides.width.value_or(options.dump_width);
+            options.dump_area = overrides.area.value_or(options.dump_area);
+            options.dump_hide_equal = overrides.hide_equal.value_or(options.dump_hide_equal);
+            if (overrides.color) {
+                auto header = *report.header;
+                header.dump_color = *overrides.color;
+                options.color = render_options(header, STDOUT_FILENO).color;
+            }
+            render(report, options, stdout);
+        }
+        offset += reinterpret_cast<ReportHeader const*>(bytes + offset)->size;
+    }
+    munmap(data, size);
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    static option const options[]{{"list", no_argument, nullptr, 'l'},
+                                  {"width", required_argument, nullptr, 'w'},
+                                  {"area", required_argument, nullptr, 'a'},
+                                  {"hide-equal", no_argument, nullptr, 'e'},
+                                  {"color", required_argument, nullptr, 'c'},
+                                  {"debug-dir", required_argument, nullptr, 'd'},
+                                  {"help", no_argument, nullptr, 'h'},
+                                  {}};
+    Overrides overrides;
+    for (int option; (option = getopt_long(argc, argv, "lw:a:ec:d:h", options, nullptr)) != -1;) {
+        switch (option) {
+            case 'l':
+                overrides.list = true;
+                break;
+            case 'w':
+                overrides.width = atoi(optarg) > 0 ? atoi(optarg) : 16;
+                break;
+            case 'a':
+                overrides.area = strcmp(optarg, "actual") == 0   ? DumpArea::actual
+                                 : strcmp(optarg, "shadow") == 0 ? DumpArea::shadow
+                                                                 : DumpArea::both;
+                break;
+            case 'e':
+                overrides.hide_equal = true;
+                break;
+            case 'c':
+                overrides.color = strcmp(optarg, "always") == 0  ? DumpColor::always
+                                  : strcmp(optarg, "never") == 0 ? DumpColor::never
+                                                                 : DumpColor::automatic;
+                break;
+            case 'd':
+                overrides.debug_directories.push_back(optarg);
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return 2;
+        }
+    }
+    if (optind == argc) {
+        usage(stderr);
+        return 2;
+    }
+    OfflineSymbolizer symbolizer{overrides.debug_directories};
+    auto ok = true;
+    for (auto file = argv + optind; file != argv + argc; ++file) {
+        ok = print(*file, overrides, symbolizer) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+#include "shadow-stack.h"
+#include "shadow-stack.hpp"
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+
+// Thread spawn rate with and without recycling of shadow memory.
+//
+// Every thread does a guarded call with a moderately deep stack, so without the pool it has to reserve, commit
+// and fault-in its own shadow memory, and unmap it all at exit.
+
+int leaf(unsigned* data)
+{
+    return data[0] + 1;
+}
+
+int deep(unsigned* data)
+{
+    std::array<unsigned, 16 * 1024> local;
+    local[0] = data[0];
+    local.back() = data[0];
+    return shst::invoke(leaf, local.data());
+}
+
+void* worker(void*)
+{
+    std::array<unsigned, 64> data{};
+    shst::invoke(deep, data.data());
+    return nullptr;
+}
+
+double spawn_latency_us(int threads)
+{
+    auto const start = std::chrono::steady_clock::now();
+    for (int i = 0; i < threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, worker, nullptr) != 0) {
+            perror("pthread_create");
+            exit(2);
+        }
+        pthread_join(thread, nullptr);
+    }
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::micro>(elapsed).count() / threads;
+}
+
+int main(int argc, char* argv[])
+{
+    int const threads = argc > 1 ? atoi(argv[1]) : 2000;
+
+    // warm-up, let the pool get its regions
+    spawn_latency_us(16);
+
+    shst_set_shadow_pool_enabled(0);
+    auto const without_pool = spawn_latency_us(threads);
+    shst_set_shadow_pool_enabled(1);
+    spawn_latency_us(1);
+    auto const with_pool = spawn_latency_us(threads);
+
+    printf("threads spawned: %d\n", threads);
+    printf("pool disabled: %8.2f us per thread\n", without_pool);
+    printf("pool enabled:  %8.2f us per thread\n", with_pool);
+}
@@ -0,0 +1,85 @@
+#include "shadow-stack.h"
+#include "symbolizer.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <string>
+#include <unistd.h>
+
+// Names given by the symbolizer: those backtrace_symbols() knows come out the same, static functions get their names
+// too, a library loaded later is picked up, and a lookup costs less than backtrace_symbols() does.
+
+namespace {
+
+__attribute__((noinline)) int hidden(int x)
+{
+    return x * 3;
+}
+
+std::string backtrace_symbol(void* address)
+{
+    auto const symbols = backtrace_symbols(&address, 1);
+    std::string const symbol = symbols ? symbols[0] : "";
+    free(symbols);
+    return symbol;
+}
+
+int failures = 0;
+
+void expect(bool ok, char const* what, std::string const& got)
+{
+    printf("%-40s %s (%s)\n", what, ok ? "ok" : "FAILED", got.c_str());
+    failures += !ok;
+}
+
+} // namespace
+
+int main(int, char** argv)
+{
+    auto& symbolizer = shst::Symbolizer::instance();
+
+    auto const exported = reinterpret_cast<void*>(shst_reload_config);
+    auto const exported_name = symbolizer.name(exported);
+    expect(exported_name == backtrace_symbol(exported), "exported function, as before", exported_name);
+    auto const inside = static_cast<char*>(exported) + 4;
+    expect(symbolizer.name(inside) == backtrace_symbol(inside), "offset into it, as before", symbolizer.name(inside));
+
+    auto const static_name = symbolizer.name(reinterpret_cast<void*>(hidden));
+    expect(static_name.find("hidden") != std::string::npos, "static function", static_name);
+
+    auto const lambda = [] {};
+    auto const lambda_name = symbolizer.name(reinterpret_cast<void*>(+lambda));
+    expect(lambda_name.find("lambda") != std::string::npos || lambda_name.find("_FUN") != std::string::npos,
+           "lambda",
+           lambda_name);
+
+    // built right next to this test and not linked to it
+    std::string library = argv[0];
+    library = library.substr(0, library.rfind('/') + 1) + "libshst-thread-attach.so";
+    auto const handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    auto const loaded = handle ? dlsym(handle, "pthread_create") : nullptr;
+    auto const loaded_name = loaded ? symbolizer.name(loaded) : dlerror();
+    expect(loaded && loaded_name.find("libshst-thread-attach.so(pthread_create+0)") != std::string::npos,
+           "dlopen()-ed later",
+           loaded_name);
+
+    constexpr int lookups = 10000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; ++i) {
+        (void)backtrace_symbol(inside);
+    }
+    auto const before = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; ++i) {
+        (void)symbolizer.name(inside);
+    }
+    auto const after = std::chrono::steady_clock::now() - start;
+    printf("backtrace_symbols() %.0f ns, symbolizer %.0f ns per lookup\n",
+           std::chrono::duration<double, std::nano>(before).count() / lookups,
+           std::chrono::duration<double, std::nano>(after).count() / lookups);
+
+    return failures ? 1 : 0;
+}
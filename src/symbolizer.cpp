@@ -0,0 +1,450 @@
+#include "symbolizer.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace shst {
+
+namespace {
+
+#if __SIZEOF_POINTER__ == 8
+constexpr unsigned char native_class = ELFCLASS64;
+#else
+constexpr unsigned char native_class = ELFCLASS32;
+#endif
+
+struct Counters
+{
+    unsigned long long adds;
+    unsigned long long subs;
+    bool known;
+};
+
+// descriptor of the NT_GNU_BUILD_ID note among `size` bytes of notes
+std::string find_build_id(uint8_t const* notes, size_t size)
+{
+    // the note header is three 32-bit words in both classes
+    while (size >= sizeof(ElfW(Nhdr))) {
+        auto const& note = *reinterpret_cast<ElfW(Nhdr) const*>(notes);
+        auto const name_size = (size_t{note.n_namesz} + 3) & ~size_t{3};
+        auto const desc_size = (size_t{note.n_descsz} + 3) & ~size_t{3};
+        if (name_size + desc_size > size - sizeof(note)) {
+            break;
+        }
+        auto const name = notes + sizeof(note);
+        if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+            return {reinterpret_cast<char const*>(name + name_size), note.n_descsz};
+        }
+        notes += sizeof(note) + name_size + desc_size;
+        size -= sizeof(note) + name_size + desc_size;
+    }
+    return {};
+}
+
+std::string hex(std::string const& bytes)
+{
+    std::string text;
+    char digits[3];
+    for (auto byte : bytes) {
+        snprintf(digits, sizeof(digits), "%02x", static_cast<unsigned char>(byte));
+        text += digits;
+    }
+    return text;
+}
+
+// A whole ELF file of this machine's class, mapped for reading, with its section headers checked.
+class ElfFile
+{
+  public:
+    explicit ElfFile(char const* file)
+    {
+        auto const fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        size = fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+        auto const data = size >= sizeof(ElfW(Ehdr)) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (data == MAP_FAILED) {
+            return;
+        }
+        bytes = static_cast<uint8_t const*>(data);
+        auto const& elf = *static_cast<ElfW(Ehdr) const*>(data);
+        if (memcmp(elf.e_ident, ELFMAG, SELFMAG) != 0 || elf.e_ident[EI_CLASS] != native_class ||
+            elf.e_shentsize != sizeof(ElfW(Shdr)) || !inside(elf.e_shoff, elf.e_shnum * sizeof(ElfW(Shdr)))) {
+            return;
+        }
+        sections = reinterpret_cast<ElfW(Shdr) const*>(bytes + elf.e_shoff);
+        count = elf.e_shnum;
+    }
+
+    ~ElfFile()
+    {
+        if (bytes) {
+            munmap(const_cast<uint8_t*>(bytes), size);
+        }
+    }
+
+    ElfFile(ElfFile const&) = delete;
+    ElfFile& operator=(ElfFile const&) = delete;
+
+    explicit operator bool() const noexcept
+    {
+        return sections != nullptr;
+    }
+
+    [[nodiscard]] std::string build_id() const
+    {
+        for (size_t s = 0; s < count; ++s) {
+            if (sections[s].sh_type == SHT_NOTE && inside(sections[s].sh_offset, sections[s].sh_size)) {
+                if (auto id = find_build_id(bytes + sections[s].sh_offset, sections[s].sh_size); !id.empty()) {
+                    return id;
+                }
+            }
+        }
+        return {};
+    }
+
+    // calls f(symbol, name, index) for the named symbols of every table of `type` (SHT_DYNSYM or SHT_SYMTAB)
+    template <typename F>
+    void for_each_symbol(uint32_t type, F&& f) const
+    {
+        for (size_t s = 0; s < count; ++s) {
+            auto const& table = sections[s];
+            if (table.sh_type != type || table.sh_link >= count || table.sh_entsize != sizeof(ElfW(Sym)) ||
+                !inside(table.sh_offset, table.sh_size) ||
+                !inside(sections[table.sh_link].sh_offset, sections[table.sh_link].sh_size)) {
+                continue;
+            }
+            auto const entries = reinterpret_cast<ElfW(Sym) const*>(bytes + table.sh_offset);
+            auto const entry_count = table.sh_size / sizeof(ElfW(Sym));
+            auto const strings = reinterpret_cast<char const*>(bytes + sections[table.sh_link].sh_offset);
+            auto const strings_size = sections[table.sh_link].sh_size;
+            for (size_t i = 0; i < entry_count; ++i) {
+                auto const& symbol = entries[i];
+                if (symbol.st_name == 0 || symbol.st_name >= strings_size) {
+                    continue;
+                }
+                auto const name = strings + symbol.st_name;
+                if (*name == '\0' || memchr(name, '\0', strings_size - symbol.st_name) == nullptr) {
+                    continue;
+                }
+                f(symbol, name, i);
+            }
+        }
+    }
+
+  private:
+    [[nodiscard]] bool inside(size_t offset, size_t length) const noexcept
+    {
+        return offset <= size && length <= size - offset;
+    }
+
+    uint8_t const* bytes{};
+    size_t size{};
+    ElfW(Shdr) const* sections{};
+    size_t count{};
+};
+
+} // namespace
+
+bool SymbolTable::load(char const* file)
+{
+    symbols.clear();
+    names.clear();
+    id.clear();
+    ElfFile const elf{file};
+    if (!elf) {
+        return false;
+    }
+    id = elf.build_id();
+
+    struct Candidate
+    {
+        uintptr_t address;
+        uintptr_t size;
+        char const* name;
+        // of aliases the one dladdr() would pick wins: the first one in .dynsym, then global ones of .symtab
+        int rank;
+        size_t order;
+    };
+    std::vector<Candidate> candidates;
+
+    // .symtab adds the static symbols to what .dynsym has, stripped objects have .dynsym only
+    for (auto const type : {uint32_t{SHT_DYNSYM}, uint32_t{SHT_SYMTAB}}) {
+        elf.for_each_symbol(type, [&](ElfW(Sym) const& symbol, char const* name, size_t order) {
+            // st_info is the same byte in both classes
+            auto const kind = ELF32_ST_TYPE(symbol.st_info);
+            auto const local = ELF32_ST_BIND(symbol.st_info) == STB_LOCAL;
+            if (symbol.st_shndx == SHN_UNDEF || symbol.st_shndx == SHN_ABS || kind == STT_TLS || kind == STT_SECTION ||
+                kind == STT_FILE || (type == SHT_DYNSYM && local)) {
+                return;
+            }
+            // ARM mapping symbols ($a, $d, $x...) mark code and data, they aren't names
+            if (*name == '$') {
+                return;
+            }
+            candidates.push_back(
+                    {uintptr_t{symbol.st_value}, symbol.st_size, name, type == SHT_DYNSYM ? 0 : local ? 2 : 1, order});
+        });
+    }
+    std::sort(candidates.begin(), candidates.end(), [](Candidate const& a, Candidate const& b) {
+        return a.address != b.address ? a.address < b.address : a.rank != b.rank ? a.rank < b.rank : a.order < b.order;
+    });
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        auto const& candidate = candidates[i];
+        if (i > 0 && candidates[i - 1].address == candidate.address) {
+            continue;
+        }
+        symbols.push_back({candidate.address, candidate.size, static_cast<uint32_t>(names.size())});
+        names.append(candidate.name).push_back('\0');
+    }
+    symbols.shrink_to_fit();
+    names.shrink_to_fit();
+    return true;
+}
+
+std::vector<std::string> exported_functions(char const* file)
+{
+    std::vector<std::string> functions;
+    ElfFile const elf{file};
+    if (!elf) {
+        return functions;
+    }
+    elf.for_each_symbol(SHT_DYNSYM, [&](ElfW(Sym) const& symbol, char const* name, size_t) {
+        auto const kind = ELF32_ST_TYPE(symbol.st_info);
+        auto const bind = ELF32_ST_BIND(symbol.st_info);
+        auto const visibility = ELF32_ST_VISIBILITY(symbol.st_other);
+        if (symbol.st_shndx != SHN_UNDEF && (kind == STT_FUNC || kind == STT_GNU_IFUNC) &&
+            (bind == STB_GLOBAL || bind == STB_WEAK) && (visibility == STV_DEFAULT || visibility == STV_PROTECTED)) {
+            functions.emplace_back(name);
+        }
+    });
+    return functions;
+}
+
+SymbolTable::Symbol const* SymbolTable::find(uintptr_t address) const
+{
+    auto const next = std::upper_bound(
+            symbols.begin(), symbols.end(), address, [](uintptr_t a, Symbol const& s) { return a < s.address; });
+    if (next == symbols.begin()) {
+        return nullptr;
+    }
+    auto const& symbol = *std::prev(next);
+    auto const within = address < symbol.address + symbol.size || (symbol.size == 0 && address == symbol.address);
+    return within ? &symbol : nullptr;
+}
+
+std::vector<LoadedObject> loaded_objects()
+{
+    std::vector<LoadedObject> loaded;
+    dl_iterate_phdr(
+            [](dl_phdr_info* info, size_t, void* data) {
+                LoadedObject object{info->dlpi_addr, UINTPTR_MAX, 0, info->dlpi_name ? info->dlpi_name : "", {}};
+                for (size_t i = 0; i < info->dlpi_phnum; ++i) {
+                    auto const& segment = info->dlpi_phdr[i];
+                    if (segment.p_type == PT_LOAD) {
+                        object.begin = std::min<uintptr_t>(object.begin, info->dlpi_addr + segment.p_vaddr);
+                        object.end =
+                                std::max<uintptr_t>(object.end, info->dlpi_addr + segment.p_vaddr + segment.p_memsz);
+                    } else if (segment.p_type == PT_NOTE && object.build_id.empty()) {
+                        object.build_id = find_build_id(
+                                reinterpret_cast<uint8_t const*>(info->dlpi_addr + segment.p_vaddr), segment.p_memsz);
+                    }
+                }
+                if (object.begin < object.end) {
+                    static_cast<std::vector<LoadedObject>*>(data)->push_back(std::move(object));
+                }
+                return 0;
+            },
+            &loaded);
+    return loaded;
+}
+
+// what both backtrace_symbols() variants print, the offset is relative to the symbol, or to the load bias without one
+std::string describe(char const* object, char const* symbol, uintptr_t base, uintptr_t address, bool line)
+{
+    std::string text;
+    char number[32];
+    if (object && *object) {
+        text += object;
+        text += '(';
+        if (symbol || base) {
+            text += symbol ? symbol : "";
+            auto const negative = address < base;
+            snprintf(number,
+                     sizeof(number),
+                     line ? "%c0x%" PRIxPTR : "%c%#" PRIxPTR,
+                     negative ? '-' : '+',
+                     negative ? base - address : address - base);
+            text += number;
+        }
+        text += line ? ")" : ") ";
+    }
+    snprintf(number, sizeof(number), "[%p]", reinterpret_cast<void*>(address));
+    return text + number;
+}
+
+Symbolizer& Symbolizer::instance()
+{
+    // never destroyed, reports may still be named from atexit() handlers
+    static auto const symbolizer = new Symbolizer;
+    return *symbolizer;
+}
+
+std::string Symbolizer::name(void const* address, bool line)
+{
+    auto const at = reinterpret_cast<uintptr_t>(address);
+    std::lock_guard<std::mutex> lock{mutex};
+    refresh();
+    auto found = cache.find(at);
+    if (found == cache.end()) {
+        found = cache.emplace(at, locate(at)).first;
+    }
+    auto const [module, symbol] = found->second;
+    if (module && module->indexed) {
+        return symbol ? describe(module->object.c_str(),
+                                 module->symbols.name(*symbol),
+                                 module->bias + symbol->address,
+                                 at,
+                                 line)
+                      : describe(module->object.c_str(), nullptr, module->bias, at, line);
+    }
+    Dl_info info;
+    if (dladdr(address, &info) == 0) {
+        return describe(nullptr, nullptr, 0, at, line);
+    }
+    return info.dli_sname
+                   ? describe(info.dli_fname, info.dli_sname, reinterpret_cast<uintptr_t>(info.dli_saddr), at, line)
+                   : describe(info.dli_fname, nullptr, module ? module->bias : 0, at, line);
+}
+
+std::string Symbolizer::symbol(void const* address)
+{
+    auto const at = reinterpret_cast<uintptr_t>(address);
+    std::lock_guard<std::mutex> lock{mutex};
+    refresh();
+    auto found = cache.find(at);
+    if (found == cache.end()) {
+        found = cache.emplace(at, locate(at)).first;
+    }
+    auto const [module, symbol] = found->second;
+    if (module && module->indexed) {
+        return symbol ? module->symbols.name(*symbol) : "";
+    }
+    Dl_info info;
+    return dladdr(address, &info) != 0 && info.dli_sname ? info.dli_sname : "";
+}
+
+Symbolizer::Location Symbolizer::locate(uintptr_t address)
+{
+    auto const next = std::upper_bound(
+            modules.begin(), modules.end(), address, [](uintptr_t a, auto const& m) { return a < m->begin; });
+    if (next == modules.begin() || address >= (*std::prev(next))->end) {
+        return {nullptr, nullptr};
+    }
+    auto const& module = **std::prev(next);
+    return {&module, module.symbols.find(address - module.bias)};
+}
+
+void Symbolizer::refresh()
+{
+    Counters now{};
+    dl_iterate_phdr(
+            [](dl_phdr_info* info, size_t size, void* data) {
+                auto& counters = *static_cast<Counters*>(data);
+                if (size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+                    counters = {info->dlpi_adds, info->dlpi_subs, true};
+                }
+                return 1;
+            },
+            &now);
+    if (now.known ? now.adds == adds && now.subs == subs : !modules.empty()) {
+        return;
+    }
+    adds = now.adds;
+    subs = now.subs;
+
+    // objects still there keep their index, the rest are gone or new
+    std::vector<std::unique_ptr<Module>> current;
+    for (auto const& object : loaded_objects()) {
+        auto const kept = std::find_if(modules.begin(), modules.end(), [&](auto const& m) {
+            return m && m->bias == object.bias && m->begin == object.begin && m->end == object.end;
+        });
+        if (kept != modules.end()) {
+            current.push_back(std::move(*kept));
+            continue;
+        }
+        auto module = std::make_unique<Module>(Module{object.bias, object.begin, object.end, {}, {}, false});
+        Dl_info info;
+        auto const named = dladdr(reinterpret_cast<void*>(object.begin), &info) != 0 && info.dli_fname;
+        module->object = named ? info.dli_fname : object.file;
+        // the main program has no name of its own
+        module->indexed = module->symbols.load(object.file.empty() ? "/proc/self/exe" : object.file.c_str());
+        current.push_back(std::move(module));
+    }
+    std::sort(current.begin(), current.end(), [](auto const& a, auto const& b) { return a->begin < b->begin; });
+    modules = std::move(current);
+    cache.clear();
+}
+
+OfflineSymbolizer::OfflineSymbolizer(std::vector<std::string> debug_directories)
+    : directories{std::move(debug_directories)}
+{
+}
+
+std::string OfflineSymbolizer::name(std::vector<LoadedObject> const& objects, uintptr_t address, bool line)
+{
+    auto const object = std::find_if(objects.begin(), objects.end(), [&](LoadedObject const& o) {
+        return address >= o.begin && address < o.end;
+    });
+    if (object == objects.end()) {
+        return describe(nullptr, nullptr, 0, address, line);
+    }
+    auto const table = symbols(*object);
+    auto const symbol = table ? table->find(address - object->bias) : nullptr;
+    return symbol ? describe(object->file.c_str(), table->name(*symbol), object->bias + symbol->address, address, line)
+                  : describe(object->file.c_str(), nullptr, object->bias, address, line);
+}
+
+SymbolTable const* OfflineSymbolizer::symbols(LoadedObject const& object)
+{
+    auto const key = object.build_id.empty() ? object.file : object.build_id;
+    auto found = tables.find(key);
+    if (found != tables.end()) {
+        return found->second.get();
+    }
+    std::vector<std::string> candidates;
+    auto const id = hex(object.build_id);
+    if (id.size() > 2) {
+        for (auto const& directory : directories) {
+            candidates.push_back(directory + "/.build-id/" + id.substr(0, 2) + "/" + id.substr(2) + ".debug");
+        }
+    }
+    candidates.push_back(object.file);
+    for (auto const& directory : directories) {
+        candidates.push_back(directory + object.file);
+        candidates.push_back(directory + object.file + ".debug");
+    }
+    auto table = std::make_unique<SymbolTable>();
+    auto const matching = std::find_if(candidates.begin(), candidates.end(), [&](std::string const& candidate) {
+        return !candidate.empty() && table->load(candidate.c_str()) && table->build_id() == object.build_id;
+    });
+    if (matching == candidates.end()) {
+        table.reset();
+    }
+    return tables.emplace(key, std::move(table)).first->second.get();
+}
+
+} // namespace shst
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace shst {
+
+// Symbols of an ELF file (.dynsym and .symtab) sorted by address, addresses as in the file, without load bias.
+class SymbolTable
+{
+  public:
+    struct Symbol
+    {
+        uintptr_t address;
+        uintptr_t size;
+        // offset in names
+        uint32_t name;
+    };
+
+    // false when the file can't be read or is not an ELF file of this machine's class
+    [[nodiscard]] bool load(char const* file);
+
+    // the symbol `address` is in, the way dladdr() matches: within a sized symbol or right at an unsized one
+    [[nodiscard]] Symbol const* find(uintptr_t address) const;
+
+    [[nodiscard]] char const* name(Symbol const& symbol) const noexcept
+    {
+        return names.data() + symbol.name;
+    }
+
+    // GNU build-id note of the file, empty when there's none
+    [[nodiscard]] std::string const& build_id() const noexcept
+    {
+        return id;
+    }
+
+  private:
+    std::vector<Symbol> symbols;
+    std::string names;
+    std::string id;
+};
+
+// Functions a shared library (or an executable) exports: defined in it, global or weak, visible to other objects, in
+// the order of .dynsym. Empty when the file can't be read.
+[[nodiscard]] std::vector<std::string> exported_functions(char const* file);
+
+// Object currently loaded into the process, as dl_iterate_phdr() lists it.
+struct LoadedObject
+{
+    // load bias, what symbol values are relative to
+    uintptr_t bias;
+    // [begin, end) covers all loadable segments
+    uintptr_t begin;
+    uintptr_t end;
+    // empty for the main program
+    std::string file;
+    // read from the mapped note, no file access
+    std::string build_id;
+};
+
+[[nodiscard]] std::vector<LoadedObject> loaded_objects();
+
+// The text backtrace_symbols() gives for `address`: "object(symbol+0x10) [0x7f0123456789]", or "object(+0x1234)
+// [...]" without a symbol (`base` is the load bias then), with `line` the way backtrace_symbols_fd() prints it.
+[[nodiscard]] std::string describe(char const* object,
+                                   char const* symbol,
+                                   uintptr_t base,
+                                   uintptr_t address,
+                                   bool line);
+
+// Names addresses of another process, given the objects it had loaded: on the machine the reports are read on, with
+// symbols from unstripped (or separate debug) files. A file is looked for in every debug directory by build-id
+// (<dir>/.build-id/ab/cdef....debug), then at the recorded path and under each debug directory by that path, and only
+// taken when its build-id matches. Objects which are not found get object and offset, like stripped ones.
+class OfflineSymbolizer
+{
+  public:
+    explicit OfflineSymbolizer(std::vector<std::string> debug_directories);
+
+    [[nodiscard]] std::string name(std::vector<LoadedObject> const& objects, uintptr_t address, bool line = false);
+
+  private:
+    // null when no matching file was found
+    [[nodiscard]] SymbolTable const* symbols(LoadedObject const& object);
+
+    std::vector<std::string> directories;
+    // by build-id, or by path for objects without one
+    std::unordered_map<std::string, std::unique_ptr<SymbolTable>> tables;
+};
+
+// Names code addresses of this process for reports, in the very format of backtrace_symbols() (or
+// backtrace_symbols_fd()).
+//
+// Symbol tables of every loaded object are read from their files once, on the first lookup, so static functions get
+// their names as well and a lookup is a binary search. Objects added with dlopen() (or gone with dlclose()) are
+// noticed on the next lookup. Results are memoized, reports name the same few addresses over and over. Objects whose
+// file can't be read, like the vDSO, are left to dladdr().
+class Symbolizer
+{
+  public:
+    static Symbolizer& instance();
+
+    [[nodiscard]] std::string name(void const* address, bool line = false);
+
+    // just the name of the symbol `address` is in, empty when there's none
+    [[nodiscard]] std::string symbol(void const* address);
+
+  private:
+    struct Module
+    {
+        uintptr_t bias;
+        uintptr_t begin;
+        uintptr_t end;
+        // as dladdr() names it
+        std::string object;
+        SymbolTable symbols;
+        bool indexed;
+    };
+
+    struct Location
+    {
+        Module const* module;
+        SymbolTable::Symbol const* symbol;
+    };
+
+    [[nodiscard]] Location locate(uintptr_t address);
+    void refresh();
+
+    std::mutex mutex;
+    // dl_iterate_phdr() counters the modules are up to date with
+    unsigned long long adds = ~0ull;
+    unsigned long long subs = ~0ull;
+    // sorted by begin
+    std::vector<std::unique_ptr<Module>> modules;
+    std::unordered_map<uintptr_t, Location> cache;
+};
+
+} // namespace shst
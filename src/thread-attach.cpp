@@ -0,0 +1,49 @@
+#include "shadow-stack.h"
+#include <dlfcn.h>
+#include <new>
+#include <pthread.h>
+
+// Optional pthread_create() interposer, link it in (or LD_PRELOAD it) to have every new thread attached to the
+// shadow stack before its start routine runs, and the thread loading it (normally the main thread) right away.
+// Setting up a thread is then no longer part of its first guarded call.
+
+namespace {
+
+using pthread_create_f = int (*)(pthread_t*, pthread_attr_t const*, void* (*)(void*), void*);
+
+struct Start
+{
+    void* (*routine)(void*);
+    void* arg;
+};
+
+void* attached_start(void* arg)
+{
+    auto const start = *static_cast<Start*>(arg);
+    delete static_cast<Start*>(arg);
+    shst_thread_attach();
+    return start.routine(start.arg);
+}
+
+__attribute__((constructor)) void attach_loading_thread()
+{
+    shst_thread_attach();
+}
+
+} // namespace
+
+extern "C" int
+pthread_create(pthread_t* thread, pthread_attr_t const* attr, void* (*routine)(void*), void* arg)
+{
+    static auto const real = reinterpret_cast<pthread_create_f>(dlsym(RTLD_NEXT, "pthread_create"));
+    auto start = new (std::nothrow) Start{routine, arg};
+    if (start == nullptr) {
+        // not attached, but running anyway
+        return real(thread, attr, routine, arg);
+    }
+    auto const error = real(thread, attr, attached_start, start);
+    if (error) {
+        delete start;
+    }
+    return error;
+}
@@ -0,0 +1,234 @@
+#include "shadow-stack.h"
+#include <complex.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Guarded calls of functions beyond pointer arguments and results, through shst_invoke() (the generic trampoline)
+// and SHST_TRAMPOLINE(): integer and floating point arguments on the stack, variadic calls, structs and long double
+// returned in every way the ABI has. Then corruptions found through the trampoline, the disabled trampoline and the
+// cost of a guarded call compared with shst_invoke_impl().
+
+typedef struct
+{
+    long v[5];
+} Big; // returned in memory
+
+typedef struct
+{
+    long a, b;
+} Pair; // %rax, %rdx
+
+typedef struct
+{
+    double x, y;
+} Vec; // %xmm0, %xmm1
+
+typedef struct
+{
+    long v[12];
+} Wide; // 96 bytes of stack arguments
+
+// 2 integer and 2 floating point arguments on the stack
+double mixed(int i0, int i1, int i2, int i3, int i4, int i5, int i6, int i7,
+             double d0, double d1, double d2, double d3, double d4,
+             double d5, double d6, double d7, double d8, double d9)
+{
+    return i0 + 2 * i1 + 3 * i2 + 4 * i3 + 5 * i4 + 6 * i5 + 7 * i6 + 8 * i7 + 0.5 * d0 + 0.25 * d1 + d2 - d3 +
+           d4 * d5 - d6 / 2 + d7 * 3 + d8 * 7 - d9;
+}
+
+double sum_variadic(int n, ...)
+{
+    va_list args;
+    va_start(args, n);
+    double sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += va_arg(args, double) * (i + 1);
+    }
+    va_end(args);
+    return sum;
+}
+
+Big make_big(long seed, double scale)
+{
+    Big big;
+    for (int i = 0; i < 5; ++i) {
+        big.v[i] = (long)(seed * (i + 1) * scale);
+    }
+    return big;
+}
+
+Pair make_pair(long a, long b)
+{
+    Pair pair = {a * 3, b - a};
+    return pair;
+}
+
+Vec scale_vec(Vec v, double s)
+{
+    Vec scaled = {v.x * s, v.y * s + 1};
+    return scaled;
+}
+
+long double divide(long double a, long double b)
+{
+    return a / b;
+}
+
+long double complex rotate(long double a)
+{
+    return a * I + a / 3;
+}
+
+long wide_sum(Wide w, long x)
+{
+    long sum = x;
+    for (int i = 0; i < 12; ++i) {
+        sum += w.v[i] * (i + 1);
+    }
+    // a callee owns its stack arguments, writing them is no corruption
+    ((long volatile*)w.v)[0] = 0;
+    return sum;
+}
+
+SHST_TRAMPOLINE(guarded_mixed, mixed);
+double guarded_mixed(int i0, int i1, int i2, int i3, int i4, int i5, int i6, int i7,
+                     double d0, double d1, double d2, double d3, double d4, double d5, double d6, double d7, double d8,
+                     double d9);
+
+SHST_TRAMPOLINE_STACK(guarded_wide_sum, wide_sum, 96);
+long guarded_wide_sum(Wide w, long x);
+
+void* corrupt(int volatile* victim)
+{
+    *victim += 1;
+    return NULL;
+}
+
+int leaf(int x)
+{
+    return x + 1;
+}
+
+int failures = 0;
+
+void expect(int ok, char const* what)
+{
+    printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+unsigned long long failed_checks(void)
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats.failed_checks;
+}
+
+unsigned long long calls(void)
+{
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    return stats.calls;
+}
+
+double now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// best of a few runs
+#define NS_PER_CALL(result, call)                                                                                     \
+    do {                                                                                                               \
+        int const iterations = 1 << 20;                                                                                \
+        result = 1e300;                                                                                                \
+        for (int run = 0; run < 5; ++run) {                                                                            \
+            double const start = now_ns();                                                                             \
+            for (int i = 0; i < iterations; ++i) {                                                                     \
+                sink = call;                                                                                           \
+            }                                                                                                          \
+            double const elapsed = (now_ns() - start) / iterations;                                                    \
+            result = elapsed < result ? elapsed : result;                                                              \
+        }                                                                                                              \
+    } while (0)
+
+int volatile sink;
+
+int outer(void)
+{
+    int volatile local[16] = {0};
+
+    double const expected_mixed = mixed(1, 2, 3, 4, 5, 6, 7, 8, 1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5, 8.5, 9.5, 10.5);
+    expect(shst_invoke(mixed, 1, 2, 3, 4, 5, 6, 7, 8, 1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5, 8.5, 9.5, 10.5) ==
+                   expected_mixed,
+           "stack arguments");
+    expect(guarded_mixed(1, 2, 3, 4, 5, 6, 7, 8, 1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5, 8.5, 9.5, 10.5) == expected_mixed,
+           "stack arguments, SHST_TRAMPOLINE()");
+    expect(shst_invoke(sum_variadic, 9, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0) ==
+                   sum_variadic(9, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0),
+           "variadic");
+
+    Pair const pair = shst_invoke(make_pair, 5, 11);
+    expect(pair.a == 15 && pair.b == 6, "struct returned in registers");
+    Vec const vec = shst_invoke(scale_vec, (Vec){1.5, -2.0}, 2.0);
+    expect(vec.x == 3.0 && vec.y == -3.0, "struct returned in vector registers");
+
+    expect(shst_invoke(divide, 1.0L, 3.0L) == divide(1.0L, 3.0L), "long double");
+    long double complex const rotated = shst_invoke(rotate, 6.0L);
+    expect(creall(rotated) == 2.0L && cimagl(rotated) == 6.0L, "complex long double");
+
+    Wide wide;
+    for (int i = 0; i < 12; ++i) {
+        wide.v[i] = i * i - 3;
+    }
+    long const expected_wide = wide_sum(wide, 17);
+    expect(guarded_wide_sum(wide, 17) == expected_wide && wide.v[0] == -3,
+           "96 bytes of stack arguments, SHST_TRAMPOLINE_STACK()");
+
+    unsigned long long const failed = failed_checks();
+    expect(failed == 0, "no corruption found so far");
+    shst_invoke(corrupt, &local[3]);
+    expect(failed_checks() == failed + 1, "corruption found");
+    local[3] -= 1;
+
+    // written to the frame of the caller while the guard is on, found like with shst::invoke()
+    Big const big = shst_invoke(make_big, 7, 1.5);
+    Big const expected_big = make_big(7, 1.5);
+    expect(memcmp(&big, &expected_big, sizeof big) == 0, "struct returned in memory");
+
+    unsigned long long const before = calls();
+    shst_set_enabled(0);
+    expect(shst_invoke(leaf, 41) == 42 && calls() == before, "disabled, called unguarded");
+    shst_set_enabled(1);
+
+    double direct, trampoline, impl, disabled;
+    shst_set_check_depth(1);
+    NS_PER_CALL(direct, leaf(i));
+    NS_PER_CALL(trampoline, shst_invoke(leaf, i));
+    NS_PER_CALL(impl, (int)(long)shst_invoke_impl((void*)leaf, (void*)(long)i));
+    shst_set_enabled(0);
+    NS_PER_CALL(disabled, shst_invoke(leaf, i));
+    shst_set_enabled(1);
+    printf("ns per call: direct %.1f, trampoline %.1f, shst_invoke_impl() %.1f, disabled trampoline %.1f\n",
+           direct,
+           trampoline,
+           impl,
+           disabled);
+
+    return local[0];
+}
+
+int main(void)
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    shst_invoke(outer);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#include "shadow-stack.h"
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+// An exception thrown by a callee called through a trampoline leaves the guard on its way out: the next guarded call
+// from the same place finds no stale frame (which would fail an assertion) and no corruption.
+
+extern "C" int thrower(int x)
+{
+    if (x) {
+        throw std::runtime_error("thrown");
+    }
+    return 1;
+}
+
+extern "C" int guarded_thrower(int x);
+SHST_TRAMPOLINE(guarded_thrower, thrower);
+
+int main()
+{
+    setenv("SHST_REACTION", "ignore", 1);
+    shst_reload_config();
+
+    bool caught = false;
+    int returned = 0;
+    for (int i = 0; i < 3; ++i) {
+        try {
+            returned += guarded_thrower(0);
+            guarded_thrower(1);
+        } catch (std::runtime_error const& e) {
+            caught = true;
+        }
+    }
+
+    shst_stats stats;
+    shst_get_thread_stats(&stats);
+    bool const ok = caught && returned == 3 && stats.calls == 6 && stats.failed_checks == 0;
+    printf("exceptions caught through the trampoline: %s, guarded calls %llu, failed checks %llu\n",
+           caught ? "yes" : "no",
+           stats.calls,
+           stats.failed_checks);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+#include "shadow-stack.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Overwrites the return address of the guarded call with garbage. With SHST_CHECK_MODE=watch the write traps right
+// away and gets recorded, then reported and healed as the guard is left, in exact mode (the fallback) the post-return
+// check heals it before the corrupted address is used. Either way the program survives, but only because the
+// corruption got caught.
+
+void* smash_return_address(void* value)
+{
+    // frame pointer of the caller, which is the trampoline holding the guard
+    void** caller_fp = *(void***)__builtin_frame_address(0);
+    caller_fp[1] = value;
+    return NULL;
+}
+
+int main()
+{
+    setenv("SHST_REACTION", "heal", 1);
+    shst_reload_config();
+
+    shst_check_mode mode = shst_set_check_mode(SHST_CHECK_WATCH);
+    printf("check mode: %s\n", mode == SHST_CHECK_WATCH ? "watch" : "exact (watchpoints not available)");
+
+    shst_invoke(smash_return_address, (void*)0xbad0bad0);
+
+    printf("survived\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include "watchpoints.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#ifndef TRAP_PERF
+#define TRAP_PERF 6
+#endif
+
+namespace shst {
+
+namespace {
+
+std::atomic<Watchpoints::hit_f> hit_handler{};
+struct sigaction previous_action;
+
+// parked breakpoints point here, it has to be a valid user space address even when disabled
+long parking_spot;
+
+void const* instruction_pointer(void* context)
+{
+    auto uc = static_cast<ucontext_t*>(context);
+#if defined(__x86_64__)
+    return reinterpret_cast<void const*>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+    return reinterpret_cast<void const*>(uc->uc_mcontext.pc);
+#else
+    (void)uc;
+    return nullptr;
+#endif
+}
+
+void on_sigtrap(int signo, siginfo_t* info, void* context)
+{
+    if (info->si_code == TRAP_PERF) {
+        if (auto handler = hit_handler.load(std::memory_order_relaxed)) {
+            auto const saved_errno = errno;
+            handler(info->si_addr, instruction_pointer(context));
+            errno = saved_errno;
+            return;
+        }
+    }
+    // not ours, e.g. a breakpoint compiled into the program
+    if (previous_action.sa_flags & SA_SIGINFO) {
+        previous_action.sa_sigaction(signo, info, context);
+    } else if (previous_action.sa_handler == SIG_DFL) {
+        signal(SIGTRAP, SIG_DFL);
+        raise(SIGTRAP);
+    } else if (previous_action.sa_handler != SIG_IGN) {
+        previous_action.sa_handler(signo);
+    }
+}
+
+void install_handler()
+{
+    struct sigaction action{};
+    action.sa_sigaction = on_sigtrap;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTRAP, &action, &previous_action);
+}
+
+#ifdef PERF_ATTR_SIZE_VER7
+// modifying a breakpoint requires all other attributes to stay exactly as they were at open
+perf_event_attr make_attr(void const* address)
+{
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_BREAKPOINT;
+    attr.size = sizeof(attr);
+    attr.bp_type = HW_BREAKPOINT_W;
+    attr.bp_len = HW_BREAKPOINT_LEN_8;
+    attr.bp_addr = reinterpret_cast<uintptr_t>(address ? address : &parking_spot);
+    attr.disabled = address == nullptr;
+    attr.sample_period = 1;
+    // makes the kernel put the written address in si_addr
+    attr.sample_type = PERF_SAMPLE_ADDR;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.sigtrap = 1;
+    attr.remove_on_exec = 1;
+    return attr;
+}
+#endif
+
+} // namespace
+
+Watchpoints::~Watchpoints()
+{
+    close();
+}
+
+bool Watchpoints::open(hit_f on_hit)
+{
+#ifdef PERF_ATTR_SIZE_VER7
+    if (is_open()) {
+        return true;
+    }
+    static std::once_flag handler_installed;
+    hit_handler.store(on_hit, std::memory_order_relaxed);
+    std::call_once(handler_installed, install_handler);
+
+    auto attr = make_attr(nullptr);
+    for (auto& fd : fds) {
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) {
+            auto const error = errno;
+            close();
+            errno = error;
+            return false;
+        }
+    }
+    watched.fill(nullptr);
+    return true;
+#else
+    (void)on_hit;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+void Watchpoints::close()
+{
+    for (auto& fd : fds) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+
+void Watchpoints::watch(size_t slot, void const* address)
+{
+#ifdef PERF_ATTR_SIZE_VER7
+    if (!is_open() || watched[slot] == address) {
+        return;
+    }
+    auto attr = make_attr(address);
+    if (ioctl(fds[slot], PERF_EVENT_IOC_MODIFY_ATTRIBUTES, &attr) != 0) {
+        // never leave it watching the old address, that one is about to be reused by other frames
+        attr = make_attr(nullptr);
+        ioctl(fds[slot], PERF_EVENT_IOC_MODIFY_ATTRIBUTES, &attr);
+        address = nullptr;
+    }
+    watched[slot] = address;
+#else
+    (void)slot;
+    (void)address;
+#endif
+}
+
+} // namespace shst
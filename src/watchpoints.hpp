@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+namespace shst {
+
+// Hardware write watchpoints of the calling thread.
+//
+// Backed by perf_event_open() breakpoints with synchronous SIGTRAP delivery (Linux 5.13+), so a write to a
+// watched word traps in the writing thread right after the writing instruction. There are only four debug
+// registers on x86-64, so that is all a thread gets.
+class Watchpoints
+{
+  public:
+    static constexpr size_t capacity = 4;
+
+    // called from the SIGTRAP handler with the watched word that got written and the address of the instruction
+    // following the write, async-signal-safe code only
+    using hit_f = void (*)(void const* address, void const* next_instruction);
+
+    Watchpoints() = default;
+    ~Watchpoints();
+
+    Watchpoints(Watchpoints const&) = delete;
+    Watchpoints& operator=(Watchpoints const&) = delete;
+
+    // false (with errno set) when hardware breakpoints are not available: old kernel, perf_event_paranoid,
+    // seccomp, debug registers taken by a debugger...
+    [[nodiscard]] bool open(hit_f on_hit);
+    void close();
+
+    [[nodiscard]] bool is_open() const noexcept
+    {
+        return fds[0] >= 0;
+    }
+
+    // watch 8 bytes at `address` with the given slot, nullptr stops watching
+    void watch(size_t slot, void const* address);
+
+  private:
+    std::array<int, capacity> fds{-1, -1, -1, -1};
+    std::array<void const*, capacity> watched{};
+};
+
+} // namespace shst